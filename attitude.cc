@@ -1,6 +1,7 @@
 #include <cmath>
 #include <cstdio>
 #include <stdexcept>
+#include <utility>
 
 #include "attitude.hh"
 #include "common.hh"
@@ -33,6 +34,13 @@ AttitudeTable::AttitudeTable(fitsfile *ff, int tm)
   std::printf("    - time from %.0f to %.0f\n", time[0], time[nrows-1]);
 }
 
+AttitudeTable::AttitudeTable(std::vector<double> _time, std::vector<double> _ra,
+                             std::vector<double> _dec, std::vector<double> _roll)
+  : num(_time.size()), time(std::move(_time)), ra(std::move(_ra)),
+    dec(std::move(_dec)), roll(std::move(_roll)), cache_idx(0)
+{
+}
+
 std::tuple<double, double, double> AttitudeTable::interpolate(double t)
 {
   while( time[cache_idx+1]>t and cache_idx>0 )
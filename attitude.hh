@@ -10,6 +10,9 @@ class AttitudeTable
 {
   public:
   AttitudeTable(fitsfile *ff, int tm);
+  // make from existing columns
+  AttitudeTable(std::vector<double> _time, std::vector<double> _ra,
+                std::vector<double> _dec, std::vector<double> _roll);
 
   // return ra, dec, roll, interpolated for a time given
   std::tuple<double, double, double> interpolate(double t);
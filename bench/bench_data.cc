@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "bench_data.hh"
+#include "common.hh"
+
+namespace
+{
+  // survey scan rate (deg/s)
+  constexpr double SCAN_RATE = 0.025;
+
+  AttitudeTable makeAttitude(double duration)
+  {
+    std::vector<double> time, ra, dec, roll;
+    for(double t=0; t<=duration; t += 1)
+      {
+        time.push_back(t);
+        ra.push_back(10.);
+        dec.push_back((t-0.5*duration)*SCAN_RATE);
+        roll.push_back(90. + 0.05*t);
+      }
+    return AttitudeTable(time, ra, dec, roll);
+  }
+
+  DeadCorTable makeDeadCor(double duration)
+  {
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> dist(0.95f, 1.f);
+    std::vector<double> time;
+    std::vector<float> deadc;
+    for(double t=0; t<=duration; t += 10)
+      {
+        time.push_back(t);
+        deadc.push_back(dist(rng));
+      }
+    return DeadCorTable(time, deadc);
+  }
+
+  DetMap makeDetMap(double duration)
+  {
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> xdist(1, CCD_XW);
+    std::uniform_int_distribution<int> ydist(1, CCD_YW/2);
+    std::uniform_real_distribution<double> tdist(0, duration);
+
+    std::vector<int> rawx, rawy, yextent;
+    std::vector<double> timemin, timemax;
+    for(unsigned i=0; i != CCD_XW/10; ++i)
+      {
+        rawx.push_back(xdist(rng));
+        rawy.push_back(ydist(rng));
+        yextent.push_back(ydist(rng));
+        const double t1 = tdist(rng);
+        const double t2 = tdist(rng);
+        timemin.push_back(std::min(t1, t2));
+        timemax.push_back(std::max(t1, t2));
+      }
+
+    DetMap detmap(1, false, false);
+    detmap.setBadPixels(rawx, rawy, yextent, timemin, timemax);
+    return detmap;
+  }
+}
+
+BenchData::BenchData(double duration)
+  : ra(10), dec(0),
+    instpar(192.5, 192.5, 9.6, 9.6, 0.075, 0.075, 192.5, 192.5),
+    att(makeAttitude(duration)),
+    gti({0.}, {duration}),
+    deadc(makeDeadCor(duration)),
+    detmap(makeDetMap(duration))
+{
+}
+
+Pars BenchData::pars() const
+{
+  Pars p;
+  p.sources.push_back({ra, dec});
+  return p;
+}
+
+EventTable BenchData::events(size_t num) const
+{
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<double> tdist(gti.start.front(), gti.stop.back());
+  std::uniform_real_distribution<float> xdist(0.5f, CCD_XW+0.5f);
+  std::uniform_real_distribution<float> ydist(0.5f, CCD_YW+0.5f);
+  std::uniform_real_distribution<float> pidist(300.f, 2300.f);
+
+  std::vector<double> time(num);
+  std::vector<float> ccdx(num), ccdy(num), pi(num);
+  for(size_t i=0; i != num; ++i)
+    {
+      time[i] = tdist(rng);
+      ccdx[i] = xdist(rng);
+      ccdy[i] = ydist(rng);
+      pi[i] = pidist(rng);
+    }
+  std::sort(time.begin(), time.end());
+
+  EventColumns cols;
+  cols.time = time.data();
+  cols.ccdx = ccdx.data();
+  cols.ccdy = ccdy.data();
+  cols.pi = pi.data();
+  return EventTable(cols, num, EventTable::COL_CCD | EventTable::COL_PI);
+}
+
+double benchSeconds(double t0)
+{
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count() - t0;
+}
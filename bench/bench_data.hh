@@ -0,0 +1,37 @@
+#ifndef BENCH_DATA_HH
+#define BENCH_DATA_HH
+
+#include "attitude.hh"
+#include "deadcor.hh"
+#include "events.hh"
+#include "detmap.hh"
+#include "gti.hh"
+#include "instpar.hh"
+#include "pars.hh"
+
+// Synthetic survey data for benchmarks, with a fixed random seed so
+// runs are reproducible. The pointing scans across the source at
+// (ra,dec)=(10,0) at the survey rate, with a slowly changing roll, and
+// a tenth of the detector columns have bad pixels for part of the time.
+struct BenchData
+{
+  BenchData(double duration=200);
+
+  // parameters for the source, with the other options left as default
+  Pars pars() const;
+
+  // num events at random times and detector positions, with PI
+  EventTable events(size_t num) const;
+
+  double ra, dec;
+  InstPar instpar;
+  AttitudeTable att;
+  GTITable gti;
+  DeadCorTable deadc;
+  DetMap detmap;
+};
+
+// seconds since t0 (from steady_clock)
+double benchSeconds(double t0=0);
+
+#endif
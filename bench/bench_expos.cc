@@ -0,0 +1,112 @@
+// Compare the cost and accuracy of the exposure map methods. The
+// exact pixel areas from --expos-method=area are the reference, which
+// the raster method approaches when oversampled by k in each
+// direction and averaged back to the output pixel size. k is odd so
+// that the oversampled pixels line up with the output pixels.
+//
+// usage: bench_expos [pixsize]
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "bench_data.hh"
+#include "expos_mode.hh"
+#include "expos_plan.hh"
+
+namespace
+{
+  struct Result
+  {
+    std::string name;
+    double secs;
+    Image<float> img;
+  };
+
+  Result run(const std::string& name, const Pars& pars, BenchData& data,
+             const Mask& mask)
+  {
+    const double t0 = benchSeconds();
+    TimeSegPlanner planner(pars, data.att, data.gti, data.instpar);
+    Image<float> img = makeExposure(pars, planner, data.gti, data.att,
+                                    data.detmap, mask, data.instpar, data.deadc);
+    return Result{name, benchSeconds(t0), img};
+  }
+
+  // average blocks of k x k pixels
+  Image<float> binImage(const Image<float>& in, unsigned k)
+  {
+    Image<float> out(in.xw/k, in.yw/k, 0.f);
+    for(unsigned y=0; y != in.yw; ++y)
+      for(unsigned x=0; x != in.xw; ++x)
+        out(x/k, y/k) += in(x, y) / float(k*k);
+    return out;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const float pixsize = argc > 1 ? float(std::atof(argv[1])) : 8;
+
+  BenchData data;
+
+  // overlapping masks near the source
+  Mask mask;
+  mask.setMaskPts({{10.05, 0.02, 25}, {10.05, 0.07, 20}, {10.08, 0.04, 15}});
+
+  Pars pars = data.pars();
+  pars.projmode = Pars::AVERAGE_FOV;
+  pars.pixsize = pixsize;
+  pars.xw = pars.yw = unsigned(std::ceil(600 / pixsize));
+  pars.deltat = 0.05;
+
+  std::vector<Result> results;
+
+  Pars areapars(pars);
+  areapars.exposmethod = Pars::EXPOS_AREA;
+  results.push_back(run("area", areapars, data, mask));
+
+  for(unsigned k : {1, 3, 5, 9, 17})
+    {
+      Pars rpars(pars);
+      rpars.pixsize = pixsize / k;
+      rpars.xw = pars.xw * k;
+      rpars.yw = pars.yw * k;
+      Result r = run("raster k=" + std::to_string(k), rpars, data, mask);
+      r.img = binImage(r.img, k);
+      results.push_back(r);
+    }
+
+  Pars prepars(pars);
+  prepars.prefilter = true;
+  results.push_back(run("raster prefilter", prepars, data, mask));
+
+  // differences from the exact areas, relative to its mean and
+  // maximum
+  const Image<float>& ref = results[0].img;
+  double refsum = 0, refmax = 0;
+  for(float v : ref.arr)
+    {
+      refsum += v;
+      refmax = std::max(refmax, double(v));
+    }
+  const double refmean = refsum / ref.size();
+
+  std::printf("\npixsize %g, %ux%u output pixels\n", pixsize, pars.xw, pars.yw);
+  std::printf("%-18s %10s %14s %14s\n", "method", "time (s)", "mean |diff|", "max |diff|");
+  for(const Result& r : results)
+    {
+      double sumdiff = 0, maxdiff = 0;
+      for(unsigned i=0; i != ref.size(); ++i)
+        {
+          const double d = std::abs(double(r.img.arr[i]) - ref.arr[i]);
+          sumdiff += d;
+          maxdiff = std::max(maxdiff, d);
+        }
+      std::printf("%-18s %10.3f %14.3e %14.3e\n", r.name.c_str(), r.secs,
+                  sumdiff / ref.size() / refmean, maxdiff / refmax);
+    }
+
+  return 0;
+}
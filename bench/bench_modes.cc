@@ -0,0 +1,148 @@
+// Time each projection mode. The per-event projection kernel is run
+// through the virtual ProjMode interface and through the concrete
+// mode class (as Pars::withProjMode gives to the event and raster
+// loops), to show the gain from specializing the loops for each mode.
+// The event projection into an image and the raster exposure map are
+// also timed for each mode.
+//
+// usage: bench_modes [numevents]
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "bench_data.hh"
+#include "event_proj.hh"
+#include "expos_mode.hh"
+#include "expos_plan.hh"
+#include "source_track.hh"
+#include "visibility.hh"
+
+namespace
+{
+  // source position, roll and event position for the kernel
+  struct KernelEvent
+  {
+    float sx, sy, roll, x, y;
+  };
+
+  std::vector<KernelEvent> kernelEvents(size_t num)
+  {
+    std::mt19937 rng(4);
+    std::uniform_real_distribution<float> pdist(0.f, float(CCD_XW));
+    std::uniform_real_distribution<float> rdist(-180.f, 180.f);
+    std::vector<KernelEvent> evts(num);
+    for(auto& e : evts)
+      e = {pdist(rng), pdist(rng), rdist(rng), pdist(rng), pdist(rng)};
+    return evts;
+  }
+
+  // project each event relative to its source, as in processEvents.
+  // With Mode=ProjMode, this uses virtual calls.
+  template<class Mode>
+  double projectKernel(const Mode& projmode, const std::vector<KernelEvent>& evts)
+  {
+    double sum = 0;
+    for(const KernelEvent& e : evts)
+      {
+        const Point srcccd(e.sx, e.sy);
+        if(!projmode.sourceValid(srcccd))
+          continue;
+        const Matrix2 mat = projmode.rotationMatrix(e.roll, srcccd - Point(192.5f, 192.5f));
+        const Point rel = mat.apply(Point(e.x, e.y) - projmode.origin(srcccd));
+        sum += rel.x + rel.y;
+      }
+    return sum;
+  }
+
+  struct ModeCase
+  {
+    std::string name;
+    Pars::projmodetype projmode;
+    std::vector<float> projargs;
+  };
+}
+
+int main(int argc, char** argv)
+{
+  const size_t numevents = argc > 1 ? size_t(std::atol(argv[1])) : 2000000;
+
+  BenchData data;
+  const EventTable events = data.events(numevents);
+  const std::vector<KernelEvent> kevts = kernelEvents(numevents);
+
+  const std::vector<ModeCase> cases = {
+    {"fov", Pars::AVERAGE_FOV, {}},
+    {"fov_sky", Pars::AVERAGE_FOV_SKY, {}},
+    {"full", Pars::AVERAGE_FULL, {}},
+    {"det", Pars::WHOLE_DET, {}},
+    {"radial", Pars::RADIAL, {0, 100, 192, 192}},
+    {"radial_sym", Pars::RADIAL_SYM, {0, 100, 192, 192}},
+    {"box", Pars::BOX, {96, 96, 288, 288}},
+  };
+
+  struct Row
+  {
+    std::string name;
+    double kvirt, kconc, events, expos;
+  };
+  std::vector<Row> rows;
+
+  for(const ModeCase& mc : cases)
+    {
+      Pars pars = data.pars();
+      pars.projmode = mc.projmode;
+      pars.projargs = mc.projargs;
+      pars.deltat = 0.05;
+
+      Row row{mc.name, 0, 0, 0, 0};
+
+      // the result is printed so the loops are not optimized away
+      std::unique_ptr<ProjMode> virtmode = pars.createProjMode();
+      double t0 = benchSeconds();
+      const double sumvirt = projectKernel<ProjMode>(*virtmode, kevts);
+      row.kvirt = benchSeconds(t0);
+
+      double sumconc = 0;
+      t0 = benchSeconds();
+      pars.withProjMode([&](const auto& projmode)
+      {
+        sumconc = projectKernel(projmode, kevts);
+      });
+      row.kconc = benchSeconds(t0);
+      std::printf("  - %s kernel sums %g %g\n", mc.name.c_str(), sumvirt, sumconc);
+
+      t0 = benchSeconds();
+      {
+        auto vis = buildVisibility(pars, *virtmode, data.att, data.gti, data.instpar);
+        auto tracks = buildTracks(vis, data.att, data.instpar);
+        Image<int> img(pars.xw, pars.yw, 0);
+        projectEvents(pars, events, vis, tracks, data.gti, data.att, Mask(),
+                      data.instpar, &img, nullptr);
+      }
+      row.events = benchSeconds(t0);
+
+      t0 = benchSeconds();
+      {
+        TimeSegPlanner planner(pars, data.att, data.gti, data.instpar);
+        makeExposure(pars, planner, data.gti, data.att, data.detmap, Mask(),
+                     data.instpar, data.deadc);
+      }
+      row.expos = benchSeconds(t0);
+
+      rows.push_back(row);
+    }
+
+  std::printf("\n%lu events, one thread\n", numevents);
+  std::printf("%-12s %14s %14s %8s %12s %12s\n", "mode", "virtual (ns)",
+              "concrete (ns)", "speedup", "events (s)", "expos (s)");
+  for(const Row& r : rows)
+    std::printf("%-12s %14.2f %14.2f %8.2f %12.3f %12.3f\n", r.name.c_str(),
+                r.kvirt*1e9/numevents, r.kconc*1e9/numevents, r.kvirt/r.kconc,
+                r.events, r.expos);
+
+  return 0;
+}
@@ -0,0 +1,31 @@
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+
+#include "cache_mode.hh"
+#include "event_cache.hh"
+
+// make the cache entry for the event file, so that later runs with
+// the same inputs can use it
+
+void cacheMode(const Pars& pars)
+{
+  if(pars.cache_dir.empty())
+    throw std::runtime_error("No cache directory given (use --cache-dir)");
+
+  if(pars.cache_prune)
+    pruneCache(pars.cache_dir);
+
+  if(!canCache(pars))
+    throw std::runtime_error("Cannot cache input files which are not local files");
+
+  const std::string cachefn = cacheFilename(pars);
+  if(std::filesystem::exists(cachefn))
+    {
+      std::printf("Cache file %s already exists\n", cachefn.c_str());
+      return;
+    }
+
+  // loading the event file makes the cache entry
+  pars.loadEventFile(EventTable::COL_NONE);
+}
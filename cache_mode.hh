@@ -0,0 +1,8 @@
+#ifndef CACHE_MODE_HH
+#define CACHE_MODE_HH
+
+#include "pars.hh"
+
+void cacheMode(const Pars& pars);
+
+#endif
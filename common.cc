@@ -24,8 +24,7 @@ void check_fitsio_status(int status)
     }
 }
 
-void read_fits_column(fitsfile *ff, const char* name, int type, long nrows,
-                      void *retn)
+int get_fits_colnum(fitsfile *ff, const char* name)
 {
   char col[80];
   std::strcpy(col, name);
@@ -34,6 +33,14 @@ void read_fits_column(fitsfile *ff, const char* name, int type, long nrows,
   int cidx;
   fits_get_colnum(ff, CASEINSEN, col, &cidx, &status);
   check_fitsio_status(status);
+  return cidx;
+}
+
+void read_fits_column(fitsfile *ff, const char* name, int type, long nrows,
+                      void *retn)
+{
+  int status = 0;
+  int cidx = get_fits_colnum(ff, name);
   fits_read_col(ff, type, cidx, 1, 1, nrows, 0, retn, 0, &status);
   check_fitsio_status(status);
 }
@@ -14,6 +14,9 @@ void check_fitsio_status(int status);
 void read_fits_column(fitsfile *ff, const char* name,
                       int type, long nrows, void *retn);
 
+// get index of column with name given
+int get_fits_colnum(fitsfile *ff, const char* name);
+
 // move to hdu with name given
 void move_fits_hdu(fitsfile* ff, const char* name);
 
@@ -1,6 +1,7 @@
 #include <cstdio>
 #include <stdexcept>
 #include <string>
+#include <utility>
 
 #include "deadcor.hh"
 #include "common.hh"
@@ -28,6 +29,12 @@ DeadCorTable::DeadCorTable(fitsfile *ff, int tm)
   std::printf("    - successfully read %ld entries\n", nrows);
 }
 
+DeadCorTable::DeadCorTable(std::vector<double> _time, std::vector<float> _deadc)
+  : num(_time.size()), time(std::move(_time)), deadc(std::move(_deadc)),
+    cache_idx(0)
+{
+}
+
 float DeadCorTable::interpolate(double t)
 {
   // simple linear scan - should be ok if we're processing in time order
@@ -8,6 +8,8 @@ class DeadCorTable
 {
 public:
   DeadCorTable(fitsfile *ff, int tm);
+  // make from existing columns
+  DeadCorTable(std::vector<double> _time, std::vector<float> _deadc);
 
   float interpolate(double t);
 
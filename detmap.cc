@@ -3,17 +3,20 @@
 #include <cstdio>
 #include <limits>
 #include <stdexcept>
+#include <utility>
 
 #include "detmap.hh"
 #include "common.hh"
 #include "instpar.hh"
 
 DetMap::DetMap(int _tm, bool detmapmask, bool shadowmask)
-  : tm(_tm),
-    num_entries(0),
+  : num_entries(0),
+    tm(_tm),
     cache_ti(-1),
     init_map(CCD_XW, CCD_YW),
-    cache_map(CCD_XW, CCD_YW)
+    cache_map(CCD_XW, CCD_YW),
+    cache_boxw(0),
+    cache_filtered(CCD_XW, CCD_YW)
 {
   // setup standard detector map, etc
   if(detmapmask)
@@ -89,6 +92,29 @@ void DetMap::read(fitsfile *ff)
                   nrows, num_entries);
     }
 
+  updateEdges();
+}
+
+void DetMap::setBadPixels(std::vector<int> _rawx, std::vector<int> _rawy,
+                          std::vector<int> _yextent,
+                          std::vector<double> _timemin, std::vector<double> _timemax)
+{
+  num_entries = _rawx.size();
+  rawx = std::move(_rawx);
+  rawy = std::move(_rawy);
+  yextent = std::move(_yextent);
+  timemin = std::move(_timemin);
+  timemax = std::move(_timemax);
+  cache_ti = -1;
+  cache_boxw = 0;
+
+  updateEdges();
+}
+
+void DetMap::updateEdges()
+{
+  const double inf = std::numeric_limits<double>::infinity();
+
   // get list of times where things change
   tedge.clear();
   tedge.push_back(-inf);
@@ -140,10 +166,21 @@ void DetMap::checkCache(double t)
     }
 }
 
+int DetMap::epochIndex(double t) const
+{
+  // same convention as checkCache: tedge[i] < t <= tedge[i+1]
+  auto it = std::lower_bound(tedge.begin(), tedge.end(), t);
+  return std::max(int(it - tedge.begin()) - 1, 0);
+}
+
 void DetMap::buildMapImage(double t)
 {
   cache_map = init_map;
 
+  // filtered map needs rebuilding
+  cache_sat.clear();
+  cache_boxw = 0;
+
   for(size_t i=0; i != num_entries; ++i)
     if(t>=timemin[i] && t<timemax[i])
       {
@@ -167,3 +204,202 @@ void DetMap::buildMapImage(double t)
           }
       }
 }
+
+void SummedArea::build(const Image<float>& map)
+{
+  const int sw = CCD_XW+1;
+  const int sh = CCD_YW+1;
+
+  sat.assign(sw*sh, 0.);
+  rowcum.assign(sw*CCD_YW, 0.);
+  rowcum2.assign(sw*CCD_YW, 0.);
+  for(int y=0; y<int(CCD_YW); ++y)
+    {
+      double rowsum = 0;
+      double* c = &rowcum[y*sw];
+      double* c2 = &rowcum2[y*sw];
+      for(int x=0; x<int(CCD_XW); ++x)
+        {
+          rowsum += map(x, y);
+          sat[(y+1)*sw+x+1] = sat[y*sw+x+1] + rowsum;
+          c[x+1] = rowsum;
+          c2[x+1] = c2[x] + 0.5*(c[x]+c[x+1]);
+        }
+    }
+}
+
+double SummedArea::rowIntegral(int row, double x) const
+{
+  const double* c = &rowcum[row*(CCD_XW+1)];
+  if(x <= 0)
+    return 0.;
+  if(x >= CCD_XW)
+    return c[CCD_XW];
+  const int ix = int(x);
+  return c[ix] + (x-ix)*(c[ix+1]-c[ix]);
+}
+
+double SummedArea::rowIntegral2(int row, double x) const
+{
+  const double* c = &rowcum[row*(CCD_XW+1)];
+  const double* c2 = &rowcum2[row*(CCD_XW+1)];
+  if(x <= 0)
+    return 0.;
+  if(x >= CCD_XW)
+    return c2[CCD_XW] + (x-CCD_XW)*c[CCD_XW];
+  const int ix = int(x);
+  const double fx = x-ix;
+  return c2[ix] + fx*c[ix] + 0.5*fx*fx*(c[ix+1]-c[ix]);
+}
+
+double SummedArea::edgeIntegral(int row, double ex, double ey,
+                                double y0, double y1) const
+{
+  const double x0 = ex + ey*y0;
+  const double x1 = ex + ey*y1;
+  // avoid dividing by a tiny slope for near vertical edges
+  if(std::abs(x1-x0) < 1e-3)
+    return rowIntegral(row, 0.5*(x0+x1)) * (y1-y0);
+  return (rowIntegral2(row, x1) - rowIntegral2(row, x0)) / ey;
+}
+
+double SummedArea::integral(double x, double y) const
+{
+  // As the map is constant in each pixel, this is a bilinear
+  // interpolation of the table.
+  const int sw = CCD_XW+1;
+  x = std::clamp(x, 0., double(CCD_XW));
+  y = std::clamp(y, 0., double(CCD_YW));
+  const int ix = std::min(int(x), int(CCD_XW)-1);
+  const int iy = std::min(int(y), int(CCD_YW)-1);
+  const double fx = x-ix;
+  const double fy = y-iy;
+  const double* s0 = &sat[iy*sw+ix];
+  const double* s1 = s0 + sw;
+  return (1-fy)*((1-fx)*s0[0] + fx*s0[1]) + fy*((1-fx)*s1[0] + fx*s1[1]);
+}
+
+double SummedArea::boxIntegral(double x0, double x1, double y0, double y1) const
+{
+  return integral(x1, y1) - integral(x0, y1) - integral(x1, y0) + integral(x0, y0);
+}
+
+// area of box on the detector
+static double detBoxArea(double x0, double x1, double y0, double y1)
+{
+  const double w = std::clamp(x1, 0., double(CCD_XW)) - std::clamp(x0, 0., double(CCD_XW));
+  const double h = std::clamp(y1, 0., double(CCD_YW)) - std::clamp(y0, 0., double(CCD_YW));
+  return std::max(w, 0.) * std::max(h, 0.);
+}
+
+double SummedArea::boxMean(double x0, double x1, double y0, double y1) const
+{
+  const double area = detBoxArea(x0, x1, y0, y1);
+  return area > 0 ? boxIntegral(x0, x1, y0, y1) / area : 0.;
+}
+
+double SummedArea::footprintMean(double cx, double cy, const Matrix2& mat) const
+{
+  // half edge vectors
+  const double ax = 0.5*mat.m00, ay = 0.5*mat.m10;
+  const double bx = 0.5*mat.m01, by = 0.5*mat.m11;
+
+  // area of the footprint
+  const double footarea = std::abs(double(mat.m00)*mat.m11 - double(mat.m01)*mat.m10);
+  if(footarea <= 0)
+    return 0.;
+
+  // aligned with the detector
+  if(ay == 0 && bx == 0)
+    return boxIntegral(cx-std::abs(ax), cx+std::abs(ax),
+                       cy-std::abs(by), cy+std::abs(by)) / footarea;
+  if(ax == 0 && by == 0)
+    return boxIntegral(cx-std::abs(bx), cx+std::abs(bx),
+                       cy-std::abs(ay), cy+std::abs(ay)) / footarea;
+
+  // corners of the parallelogram, in order
+  const double px[4] = {cx-ax-bx, cx+ax-bx, cx+ax+bx, cx-ax+bx};
+  const double py[4] = {cy-ay-by, cy+ay-by, cy+ay+by, cy-ay+by};
+
+  // Between the corners in y, the footprint lies between two straight
+  // edges, so in each detector row the integral is the difference of
+  // the integrals of the row cumulative sum along the edges.
+  double ys[4] = {py[0], py[1], py[2], py[3]};
+  std::sort(ys, ys+4);
+
+  double sum = 0;
+  for(int k=0; k<3; ++k)
+    {
+      if(ys[k+1] <= ys[k])
+        continue;
+
+      // edges crossing this interval, as x = ex + ey*y
+      double ex[2], ey[2];
+      int ne = 0;
+      const double ymid = 0.5*(ys[k]+ys[k+1]);
+      for(int i=0; i<4 && ne<2; ++i)
+        {
+          const int i2 = (i+1) % 4;
+          if((py[i] > ymid) != (py[i2] > ymid))
+            {
+              ey[ne] = (px[i2]-px[i])/(py[i2]-py[i]);
+              ex[ne] = px[i] - ey[ne]*py[i];
+              ++ne;
+            }
+        }
+      if(ne < 2)
+        continue;
+
+      // make edge 1 the right hand edge
+      if(ex[0] + ey[0]*ymid > ex[1] + ey[1]*ymid)
+        {
+          std::swap(ex[0], ex[1]);
+          std::swap(ey[0], ey[1]);
+        }
+
+      const int rlo = std::max(int(std::floor(ys[k])), 0);
+      const int rhi = std::min(int(std::ceil(ys[k+1])), int(CCD_YW));
+      for(int row=rlo; row<rhi; ++row)
+        {
+          const double y0 = std::max(ys[k], double(row));
+          const double y1 = std::min(ys[k+1], double(row+1));
+          if(y1 > y0)
+            sum += edgeIntegral(row, ex[1], ey[1], y0, y1) -
+              edgeIntegral(row, ex[0], ey[0], y0, y1);
+        }
+    }
+
+  return sum / footarea;
+}
+
+const Image<float>& DetMap::getFilteredMap(double t, float boxw)
+{
+  checkCache(t);
+  if(boxw <= 1)
+    return cache_map;
+  if(boxw != cache_boxw)
+    buildFilteredMap(boxw);
+  return cache_filtered;
+}
+
+const SummedArea& DetMap::getSummedArea(double t)
+{
+  checkCache(t);
+  if(cache_sat.empty())
+    cache_sat.build(cache_map);
+  return cache_sat;
+}
+
+void DetMap::buildFilteredMap(float boxw)
+{
+  if(cache_sat.empty())
+    cache_sat.build(cache_map);
+
+  const double hw = 0.5*boxw;
+  for(int y=0; y<int(CCD_YW); ++y)
+    for(int x=0; x<int(CCD_XW); ++x)
+      cache_filtered(x, y) = float(cache_sat.boxMean(x+0.5-hw, x+0.5+hw,
+                                                     y+0.5-hw, y+0.5+hw));
+
+  cache_boxw = boxw;
+}
@@ -4,8 +4,46 @@
 #include <string>
 #include <vector>
 #include <fitsio.h>
+#include "geom.hh"
 #include "image.hh"
 
+// summed-area table of a detector map, for averaging the map over
+// areas. Coordinates are such that pixel i covers i to i+1.
+class SummedArea
+{
+public:
+  void build(const Image<float>& map);
+  void clear() { sat.clear(); rowcum.clear(); rowcum2.clear(); }
+  bool empty() const { return sat.empty(); }
+
+  // mean of the map over the box x0 to x1, y0 to y1, only counting
+  // the area on the detector (0 if none)
+  double boxMean(double x0, double x1, double y0, double y1) const;
+
+  // mean of the map over the footprint of an output pixel centred on
+  // (cx,cy), where the columns of mat are the detector vectors of the
+  // output pixel edges, taking the map as zero off the detector
+  double footprintMean(double cx, double cy, const Matrix2& mat) const;
+
+private:
+  // integral of map from (0,0) to (x,y)
+  double integral(double x, double y) const;
+  double boxIntegral(double x0, double x1, double y0, double y1) const;
+
+  // integral of row from 0 to x, and the integral of that from 0 to x
+  double rowIntegral(int row, double x) const;
+  double rowIntegral2(int row, double x) const;
+
+  // integral over y0 to y1 of rowIntegral along the edge x=ex+ey*y
+  double edgeIntegral(int row, double ex, double ey, double y0, double y1) const;
+
+private:
+  // sat(x,y) is the sum of pixels with coordinates <x and <y
+  std::vector<double> sat;
+  // cumulative sum of each row, and cumulative integral of that
+  std::vector<double> rowcum, rowcum2;
+};
+
 class DetMap
 {
 public:
@@ -23,23 +61,53 @@ public:
 
   const Image<float>& getMap(double t) { checkCache(t); return cache_map; }
 
+  // get map for time t, where each pixel is the mean of the map over
+  // a box of width boxw pixels centred on the pixel (computed from
+  // a summed-area table), ignoring the part off the detector
+  const Image<float>& getFilteredMap(double t, float boxw);
+
+  // get summed-area table of the map for time t
+  const SummedArea& getSummedArea(double t);
+
+  // index of period between changes in bad pixel table for time t
+  int epochIndex(double t) const;
+
+  // times where bad pixel table changes (starting at -inf and ending
+  // at +inf)
+  const std::vector<double>& epochEdges() const { return tedge; }
+
+  // replace bad pixel table with entries given
+  void setBadPixels(std::vector<int> _rawx, std::vector<int> _rawy,
+                    std::vector<int> _yextent,
+                    std::vector<double> _timemin, std::vector<double> _timemax);
+
 private:
   void checkCache(double t);
   void buildMapImage(double t);
   void readDetmapMask(int tm);
+  void updateEdges();
+  void buildFilteredMap(float boxw);
 
-private:
-  int tm;
-
+public:
+  // bad pixel table
   size_t num_entries;
   std::vector<int> rawx, rawy, yextent;
   std::vector<double> timemin, timemax;
 
+private:
+  int tm;
+
   // times where bad pixel table changes
   std::vector<double> tedge;
 
   int cache_ti;
   Image<float> init_map, cache_map;
+
+  // summed-area table for cached map and filtered map for cached
+  // map, if built
+  SummedArea cache_sat;
+  float cache_boxw;
+  Image<float> cache_filtered;
 };
 
 #endif
@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <cassert>
+
+#include "event_batch.hh"
+
+size_t EventBatch::blockEnd(const EventTable& events, size_t start,
+                            size_t end, double group_dt)
+{
+  size_t bend = start;
+  do
+    bend = events.groupEnd(bend, end, group_dt);
+  while(bend < end && bend-start < block_size);
+  return bend;
+}
+
+void EventBatch::maskSky(const EventTable& events, const Mask& mask,
+                         size_t start, size_t end)
+{
+  const size_t n = end-start;
+  blockstart = start;
+  skyflags.resize(n);
+  // sky positions are not loaded if there is no mask image
+  if(!events.hasSky())
+    std::fill(skyflags.begin(), skyflags.end(), 0);
+  else if(events.compact)
+    {
+      skyra.resize(n);
+      skydec.resize(n);
+      events.decodeSky(start, n, skyra.data(), skydec.data());
+      mask.flagSkyMasked(n, skyra.data(), skydec.data(), skyflags.data());
+    }
+  else
+    mask.flagSkyMasked(n, &events.ra[start], &events.dec[start],
+                       skyflags.data());
+
+  flags.resize(n);
+  sel.resize(n);
+  x.resize(n);
+  y.resize(n);
+}
+
+void EventBatch::select(const EventTable& events, const Mask& mask,
+                        size_t start, size_t end)
+{
+  assert(start >= blockstart && end-blockstart <= skyflags.size());
+
+  const size_t n = end-start;
+  std::copy(skyflags.begin()+(start-blockstart),
+            skyflags.begin()+(end-blockstart), flags.begin());
+  events.decodeCcd(start, n, x.data(), y.data());
+  mask.flagPointMasked(n, x.data(), y.data(), flags.data());
+
+  // compact unmasked events in place, without branches
+  num = 0;
+  for(size_t i=0; i != n; ++i)
+    {
+      sel[num] = start+i;
+      x[num] = x[i];
+      y[num] = y[i];
+      num += !flags[i];
+    }
+}
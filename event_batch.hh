@@ -0,0 +1,95 @@
+#ifndef EVENT_BATCH_HH
+#define EVENT_BATCH_HH
+
+#include <cstdint>
+#include <vector>
+
+#include "events.hh"
+#include "geom.hh"
+#include "mask.hh"
+
+// range of events to process
+struct Chunk
+{
+  size_t start, size;
+  // sources which may be visible during chunk
+  std::vector<size_t> srcs;
+  // index of chunk in time order
+  size_t seq;
+};
+
+// projection of events for a source
+struct SourcePose
+{
+  Point origin;
+  Matrix2 mat;
+};
+
+// Events are processed in blocks, in stages which each loop over
+// arrays, so that the loops can be vectorized:
+//  - maskSky: flag events in the block masked in the mask image
+//  - select: for a group of events in the block with the same
+//    pointing, compact the unmasked events into a selection
+//  - project: compute coordinates of the selection for a source
+class EventBatch
+{
+public:
+  // preferred number of events in a block
+  static constexpr size_t block_size = 1024;
+
+  // get end of block starting at start, made of whole groups of
+  // events with the same pointing (see EventTable::groupEnd)
+  static size_t blockEnd(const EventTable& events, size_t start,
+                         size_t end, double group_dt);
+
+  // flag events in block start to end masked in the mask image
+  void maskSky(const EventTable& events, const Mask& mask,
+               size_t start, size_t end);
+
+  // select events in start to end (inside the block) which are not
+  // masked, using the mask pointing
+  void select(const EventTable& events, const Mask& mask,
+              size_t start, size_t end);
+
+  // compute coordinates of selected events relative to source pose
+  template<bool rotate>
+  void project(const SourcePose& pose, float* relx, float* rely) const
+  {
+    const float ox = pose.origin.x;
+    const float oy = pose.origin.y;
+    const Matrix2 m = pose.mat;
+    for(size_t j=0; j<num; ++j)
+      {
+        const float dx = x[j] - ox;
+        const float dy = y[j] - oy;
+        if constexpr(rotate)
+          {
+            relx[j] = dx*m.m00 + dy*m.m01;
+            rely[j] = dx*m.m10 + dy*m.m11;
+          }
+        else
+          {
+            relx[j] = dx;
+            rely[j] = dy;
+          }
+      }
+  }
+
+  // number of selected events
+  size_t size() const { return num; }
+
+public:
+  // indices in event table of selected events
+  std::vector<size_t> sel;
+  // detector coordinates of selected events
+  std::vector<float> x, y;
+
+private:
+  size_t num = 0;
+  size_t blockstart = 0;
+  std::vector<uint8_t> skyflags, flags;
+  // decoded sky positions for compact event tables
+  std::vector<double> skyra, skydec;
+};
+
+#endif
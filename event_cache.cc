@@ -0,0 +1,394 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fitsio.h>
+
+#include "event_cache.hh"
+#include "common.hh"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+  // increase if the format or the table contents change
+  constexpr uint32_t cache_version = 1;
+  const char cache_magic[8] = {'E','R','O','C','A','C','H','E'};
+  const char* cache_ext = ".evtcache";
+
+  // alignment of arrays in file
+  constexpr uint64_t cache_align = 64;
+
+  // arrays stored in file, in order
+  enum cachearray {
+    A_EVTFN,
+    A_GTI_START, A_GTI_STOP,
+    A_ATT_TIME, A_ATT_RA, A_ATT_DEC, A_ATT_ROLL,
+    A_BP_RAWX, A_BP_RAWY, A_BP_YEXTENT, A_BP_TIMEMIN, A_BP_TIMEMAX,
+    A_DC_TIME, A_DC_DEADC,
+    A_EV_TIME, A_EV_PI, A_EV_RAWX, A_EV_RAWY, A_EV_CCDX, A_EV_CCDY,
+    A_EV_RA, A_EV_DEC,
+    NUM_ARRAYS
+  };
+
+  struct CacheHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_arrays;
+    uint64_t key;
+    // size and modification time of event file when written
+    uint64_t evt_size;
+    int64_t evt_mtime;
+  };
+
+  // position of each array in file
+  struct CacheArray
+  {
+    uint64_t offset, nbytes;
+  };
+
+  // FNV-1a hash
+  uint64_t hash_string(const std::string& s)
+  {
+    uint64_t h = 14695981039346656037ULL;
+    for(unsigned char c : s)
+      {
+        h ^= c;
+        h *= 1099511628211ULL;
+      }
+    return h;
+  }
+
+  int64_t file_mtime(const std::string& fn)
+  {
+    return int64_t(fs::last_write_time(fn).time_since_epoch().count());
+  }
+
+  // name of file without any cfitsio extension or filter, which is
+  // left in suffix
+  std::string fits_root_name(const std::string& fn, std::string* suffix=nullptr)
+  {
+    std::vector<char> fnbuf(fn.begin(), fn.end());
+    fnbuf.push_back(0);
+    char rootname[FLEN_FILENAME];
+    int status = 0;
+    fits_parse_rootname(&fnbuf[0], rootname, &status);
+    check_fitsio_status(status);
+
+    std::string root(rootname);
+    if(suffix)
+      *suffix = fn.compare(0, root.size(), root) == 0 ? fn.substr(root.size()) : fn;
+    if(root.compare(0, 7, "file://") == 0)
+      root = root.substr(7);
+    return root;
+  }
+
+  // identify a file by its path (and any cfitsio extension or
+  // filter), size and modification time, rather than hashing its
+  // contents, which would take as long as reading it
+  std::string file_identity(const std::string& fn)
+  {
+    if(fn.empty())
+      return "-";
+    std::string suffix;
+    const std::string root = fits_root_name(fn, &suffix);
+    return fs::canonical(root).string() + suffix + ':' +
+      std::to_string(fs::file_size(root)) + ':' + std::to_string(file_mtime(root));
+  }
+
+  uint64_t cache_key(const Pars& pars)
+  {
+    std::string id = std::to_string(cache_version);
+    id += '|' + file_identity(pars.evt_fn);
+    id += '|' + std::to_string(pars.tm);
+    id += '|' + std::to_string(pars.pimin) + ':' + std::to_string(pars.pimax);
+    id += '|' + file_identity(pars.gti_fn);
+    id += '|' + file_identity(pars.bpix_fn);
+    return hash_string(id);
+  }
+
+  // read-only memory mapping of a file
+  class MappedFile
+  {
+  public:
+    MappedFile(const std::string& fn)
+      : data(nullptr), size(0)
+    {
+      int fd = open(fn.c_str(), O_RDONLY);
+      if(fd < 0)
+        throw std::runtime_error("Cannot open cache file " + fn);
+      struct stat st;
+      if(fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+          size = size_t(st.st_size);
+          void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if(ptr != MAP_FAILED)
+            data = static_cast<const char*>(ptr);
+        }
+      close(fd);
+      if(data == nullptr)
+        throw std::runtime_error("Cannot map cache file " + fn);
+    }
+    ~MappedFile()
+    {
+      munmap(const_cast<char*>(data), size);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data;
+    size_t size;
+  };
+
+  // check header is valid, returning it
+  const CacheHeader& check_header(const MappedFile& mf, const std::string& fn)
+  {
+    const size_t dirsize = sizeof(CacheHeader) + NUM_ARRAYS*sizeof(CacheArray);
+    const CacheHeader& hdr = *reinterpret_cast<const CacheHeader*>(mf.data);
+    if(mf.size < dirsize ||
+       std::memcmp(hdr.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+       hdr.version != cache_version || hdr.num_arrays != NUM_ARRAYS)
+      throw std::runtime_error("Invalid cache file " + fn);
+
+    const CacheArray* arrs = reinterpret_cast<const CacheArray*>
+      (mf.data + sizeof(CacheHeader));
+    for(int i=0; i != NUM_ARRAYS; ++i)
+      if(arrs[i].offset + arrs[i].nbytes > mf.size)
+        throw std::runtime_error("Truncated cache file " + fn);
+
+    return hdr;
+  }
+
+  // array in mapped file
+  template<class T> std::pair<const T*, size_t>
+  get_array(const MappedFile& mf, cachearray idx)
+  {
+    const CacheArray* arrs = reinterpret_cast<const CacheArray*>
+      (mf.data + sizeof(CacheHeader));
+    return std::make_pair(reinterpret_cast<const T*>(mf.data + arrs[idx].offset),
+                          size_t(arrs[idx].nbytes / sizeof(T)));
+  }
+
+  template<class T> std::vector<T>
+  copy_array(const MappedFile& mf, cachearray idx)
+  {
+    auto [ptr, n] = get_array<T>(mf, idx);
+    return std::vector<T>(ptr, ptr+n);
+  }
+
+  // collects arrays to write
+  class CacheWriter
+  {
+  public:
+    template<class T> void add(cachearray idx, const T* ptr, size_t n)
+    {
+      arrays[idx] = std::make_pair(reinterpret_cast<const char*>(ptr), n*sizeof(T));
+    }
+    template<class T> void add(cachearray idx, const std::vector<T>& v)
+    {
+      add(idx, v.data(), v.size());
+    }
+
+    void write(std::ofstream& out, CacheHeader hdr) const
+    {
+      // work out positions of arrays
+      CacheArray dir[NUM_ARRAYS];
+      uint64_t pos = sizeof(CacheHeader) + sizeof(dir);
+      for(int i=0; i != NUM_ARRAYS; ++i)
+        {
+          pos = div_round_up(pos, cache_align) * cache_align;
+          dir[i].offset = pos;
+          dir[i].nbytes = arrays[i].second;
+          pos += arrays[i].second;
+        }
+
+      out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+      out.write(reinterpret_cast<const char*>(dir), sizeof(dir));
+      uint64_t cur = sizeof(CacheHeader) + sizeof(dir);
+      const char zeros[cache_align] = {};
+      for(int i=0; i != NUM_ARRAYS; ++i)
+        {
+          out.write(zeros, dir[i].offset - cur);
+          out.write(arrays[i].first, arrays[i].second);
+          cur = dir[i].offset + dir[i].nbytes;
+        }
+    }
+
+  private:
+    std::pair<const char*, size_t> arrays[NUM_ARRAYS] = {};
+  };
+}
+
+bool canCache(const Pars& pars)
+{
+  for(const std::string* fn : {&pars.evt_fn, &pars.gti_fn, &pars.bpix_fn})
+    if(!fn->empty() && !fs::is_regular_file(fits_root_name(*fn)))
+      return false;
+  return true;
+}
+
+std::string cacheFilename(const Pars& pars)
+{
+  char hex[17];
+  std::snprintf(hex, sizeof(hex), "%016llx",
+                static_cast<unsigned long long>(cache_key(pars)));
+  return (fs::path(pars.cache_dir) / (std::string("evt_") + hex + cache_ext)).string();
+}
+
+void writeCache(const std::string& filename, const Pars& pars,
+                const EventFileTables& tables)
+{
+  const auto& [events, gti, att, detmap, deadc] = tables;
+  if(events.compact || events.rawx.size() != events.num_entries ||
+     events.ccdx.size() != events.num_entries ||
+     events.ra.size() != events.num_entries ||
+     events.pi.size() != events.num_entries)
+    throw std::runtime_error("Cannot cache events without all columns");
+
+  std::printf("Writing cache file %s\n", filename.c_str());
+  fs::create_directories(pars.cache_dir);
+
+  CacheHeader hdr;
+  std::memcpy(hdr.magic, cache_magic, sizeof(cache_magic));
+  hdr.version = cache_version;
+  hdr.num_arrays = NUM_ARRAYS;
+  hdr.key = cache_key(pars);
+  const std::string evtroot = fits_root_name(pars.evt_fn);
+  hdr.evt_size = fs::file_size(evtroot);
+  hdr.evt_mtime = file_mtime(evtroot);
+
+  const std::string evtfn = fs::canonical(evtroot).string();
+
+  CacheWriter cw;
+  cw.add(A_EVTFN, evtfn.data(), evtfn.size());
+  cw.add(A_GTI_START, gti.start);
+  cw.add(A_GTI_STOP, gti.stop);
+  cw.add(A_ATT_TIME, att.time);
+  cw.add(A_ATT_RA, att.ra);
+  cw.add(A_ATT_DEC, att.dec);
+  cw.add(A_ATT_ROLL, att.roll);
+  cw.add(A_BP_RAWX, detmap.rawx);
+  cw.add(A_BP_RAWY, detmap.rawy);
+  cw.add(A_BP_YEXTENT, detmap.yextent);
+  cw.add(A_BP_TIMEMIN, detmap.timemin);
+  cw.add(A_BP_TIMEMAX, detmap.timemax);
+  cw.add(A_DC_TIME, deadc.time);
+  cw.add(A_DC_DEADC, deadc.deadc);
+  cw.add(A_EV_TIME, events.time);
+  cw.add(A_EV_PI, events.pi);
+  cw.add(A_EV_RAWX, events.rawx);
+  cw.add(A_EV_RAWY, events.rawy);
+  cw.add(A_EV_CCDX, events.ccdx);
+  cw.add(A_EV_CCDY, events.ccdy);
+  cw.add(A_EV_RA, events.ra);
+  cw.add(A_EV_DEC, events.dec);
+
+  // write to a temporary file first, so other processes never see a
+  // partial file
+  const std::string tmpfn = filename + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream out(tmpfn, std::ios::binary | std::ios::trunc);
+    cw.write(out, hdr);
+    if(!out)
+      {
+        out.close();
+        fs::remove(tmpfn);
+        throw std::runtime_error("Could not write cache file " + tmpfn);
+      }
+  }
+  fs::rename(tmpfn, filename);
+}
+
+EventFileTables readCache(const std::string& filename, const Pars& pars,
+                          unsigned evtcols)
+{
+  std::printf("Opening cache file %s\n", filename.c_str());
+  MappedFile mf(filename);
+  const CacheHeader& hdr = check_header(mf, filename);
+  if(hdr.key != cache_key(pars))
+    throw std::runtime_error("Cache file does not match inputs " + filename);
+
+  GTITable gti(copy_array<double>(mf, A_GTI_START),
+               copy_array<double>(mf, A_GTI_STOP));
+  AttitudeTable att(copy_array<double>(mf, A_ATT_TIME),
+                    copy_array<double>(mf, A_ATT_RA),
+                    copy_array<double>(mf, A_ATT_DEC),
+                    copy_array<double>(mf, A_ATT_ROLL));
+  DeadCorTable deadc(copy_array<double>(mf, A_DC_TIME),
+                     copy_array<float>(mf, A_DC_DEADC));
+
+  DetMap detmap(pars.tm, pars.detmapmask, pars.shadowmask);
+  detmap.setBadPixels(copy_array<int>(mf, A_BP_RAWX),
+                      copy_array<int>(mf, A_BP_RAWY),
+                      copy_array<int>(mf, A_BP_YEXTENT),
+                      copy_array<double>(mf, A_BP_TIMEMIN),
+                      copy_array<double>(mf, A_BP_TIMEMAX));
+
+  // only the pages of the event columns needed are read
+  EventColumns cols;
+  size_t num;
+  std::tie(cols.time, num) = get_array<double>(mf, A_EV_TIME);
+  cols.pi = get_array<float>(mf, A_EV_PI).first;
+  cols.rawx = get_array<short>(mf, A_EV_RAWX).first;
+  cols.rawy = get_array<short>(mf, A_EV_RAWY).first;
+  cols.ccdx = get_array<float>(mf, A_EV_CCDX).first;
+  cols.ccdy = get_array<float>(mf, A_EV_CCDY).first;
+  cols.ra = get_array<double>(mf, A_EV_RA).first;
+  cols.dec = get_array<double>(mf, A_EV_DEC).first;
+  EventTable events(cols, num, evtcols, pars.compact_events);
+
+  std::printf("  - read %ld GTIs, %ld attitude entries, %ld bad pixels and %ld events\n",
+              gti.num, att.num, detmap.num_entries, events.num_entries);
+
+  return std::make_tuple(std::move(events), std::move(gti), std::move(att),
+                         std::move(detmap), std::move(deadc));
+}
+
+void pruneCache(const std::string& cachedir)
+{
+  std::printf("Pruning cache directory %s\n", cachedir.c_str());
+  if(!fs::is_directory(cachedir))
+    return;
+
+  std::vector<fs::path> remove;
+  for(const auto& entry : fs::directory_iterator(cachedir))
+    {
+      if(entry.path().extension() != cache_ext)
+        continue;
+
+      bool stale = true;
+      try
+        {
+          MappedFile mf(entry.path().string());
+          const CacheHeader& hdr = check_header(mf, entry.path().string());
+          auto [ptr, len] = get_array<char>(mf, A_EVTFN);
+          const std::string evtfn(ptr, len);
+          stale = !fs::exists(evtfn) ||
+            fs::file_size(evtfn) != hdr.evt_size ||
+            file_mtime(evtfn) != hdr.evt_mtime;
+        }
+      catch(std::exception&)
+        {
+        }
+      if(stale)
+        remove.push_back(entry.path());
+    }
+
+  for(const auto& path : remove)
+    {
+      std::printf("  - removing %s\n", path.string().c_str());
+      fs::remove(path);
+    }
+  std::printf("  - removed %ld entries\n", remove.size());
+}
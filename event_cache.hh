@@ -0,0 +1,41 @@
+#ifndef EVENT_CACHE_HH
+#define EVENT_CACHE_HH
+
+#include <string>
+#include <tuple>
+
+#include "attitude.hh"
+#include "deadcor.hh"
+#include "detmap.hh"
+#include "events.hh"
+#include "gti.hh"
+#include "pars.hh"
+
+// Cache of the tables loaded from an event file, stored as a file in
+// the cache directory for each event file, TM, PI range, GTI file and
+// bad pixel file. The columns are stored in native format, aligned,
+// so they can be mapped into memory and used without parsing.
+
+typedef std::tuple<EventTable,GTITable,AttitudeTable,DetMap,DeadCorTable> EventFileTables;
+
+// are the input files local files, which can be identified for the
+// cache (cfitsio extensions and filters are allowed)?
+bool canCache(const Pars& pars);
+
+// filename of cache entry for the input files and options in pars
+std::string cacheFilename(const Pars& pars);
+
+// write the tables to the cache file given (the events should have
+// all the columns)
+void writeCache(const std::string& filename, const Pars& pars,
+                const EventFileTables& tables);
+
+// map cache file and make tables, keeping the event columns given
+EventFileTables readCache(const std::string& filename, const Pars& pars,
+                          unsigned evtcols);
+
+// remove entries in the cache directory where the event file has
+// changed or been removed, or which are invalid
+void pruneCache(const std::string& cachedir);
+
+#endif
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "event_proj.hh"
+#include "common.hh"
+#include "coords.hh"
+#include "event_batch.hh"
+
+// this is specialized for each projection mode class
+template<class Mode>
+static void processEvents(std::vector<Chunk>& chunks,
+                          std::mutex& mutex,
+                          const EventTable& events,
+                          const std::vector<SourceVisibility>& vis,
+                          const std::vector<SourceTrack>& tracks,
+                          Mode projmode,
+                          Pars pars, GTITable gti, AttitudeTable att,
+                          Mask mask, InstPar instpar,
+                          Image<int>* finalimg,
+                          EventWriter* writer)
+{
+  CoordConv coordconv(instpar);
+  Point imgcen = pars.imageCentre();
+
+  // working image (if needed)
+  Image<int> img(finalimg ? pars.xw : 0, finalimg ? pars.yw : 0, 0);
+
+  // block of events to be written
+  const size_t blocksize = writer ? writer->blockSize() : 0;
+  std::vector<EventOut> evts_out;
+  evts_out.reserve(blocksize);
+
+  // projections of valid sources
+  std::vector<SourcePose> poses;
+
+  // events being processed and their coordinates for each source
+  EventBatch batch;
+  std::vector<float> relx, rely;
+  std::vector<int> pix;
+  const int xw = pars.xw;
+  const int yw = pars.yw;
+
+  for(;;)
+    {
+      // get next time to process
+      Chunk chunk;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(chunks.empty())
+          {
+            // add our part to the total and return
+            if(finalimg)
+              finalimg->arr += img.arr;
+            return;
+          }
+        chunk = std::move(chunks.back());
+        chunks.pop_back();
+      }
+
+      const size_t end = std::min(chunk.start+chunk.size, events.num_entries);
+
+      for(size_t bstart=chunk.start; bstart<end; )
+        {
+          // block of whole groups of events
+          const size_t bend = EventBatch::blockEnd(events, bstart, end,
+                                                   pars.event_group_dt);
+          bool skymasked = false;
+
+          for(size_t gstart=bstart; gstart<bend; )
+            {
+              // group of events which use the same pointing
+              const size_t gend = events.groupEnd(gstart, bend, pars.event_group_dt);
+              const double t = 0.5*(events.getTime(gstart) + events.getTime(gend-1));
+
+              // get projection for each valid source
+              poses.clear();
+              for(size_t s : chunk.srcs)
+                {
+                  if( ! vis[s].isVisible(t) )
+                    continue;
+
+                  // get ccd coordinates of source and roll
+                  auto [src_ccdx, src_ccdy, roll] = tracks[s].interpolate(t);
+
+                  // skip if source is outsite allowed region
+                  Point srcccd(src_ccdx, src_ccdy);
+                  if( ! projmode.sourceValid(srcccd) )
+                    continue;
+
+                  // origin and any necessary rotation for mode
+                  Point delpt = srcccd - Point(instpar.x_ref, instpar.y_ref);
+                  poses.push_back({projmode.origin(srcccd),
+                        projmode.rotationMatrix(roll, delpt)});
+                }
+              if(poses.empty())
+                {
+                  gstart = gend;
+                  continue;
+                }
+
+              // mask sky positions in block when first needed
+              if(!skymasked)
+                {
+                  batch.maskSky(events, mask, bstart, bend);
+                  skymasked = true;
+                }
+
+              // unmasked events in group, using attitude at time of events
+              auto [att_ra, att_dec, att_roll] = att.interpolate(t);
+              coordconv.updatePointing(att_ra, att_dec, att_roll);
+              mask.updatePointing(coordconv);
+              batch.select(events, mask, gstart, gend);
+              const size_t n = batch.size();
+              relx.resize(n*poses.size());
+              rely.resize(n*poses.size());
+
+              // compute relative coordinates of photons for each source
+              for(size_t p=0; p != poses.size(); ++p)
+                batch.project<Mode::rotation>(poses[p], &relx[p*n], &rely[p*n]);
+
+              if(finalimg)
+                {
+                  pix.resize(n);
+                  for(size_t p=0; p != poses.size(); ++p)
+                    {
+                      const float* px_rel = &relx[p*n];
+                      const float* py_rel = &rely[p*n];
+
+                      // calculate index of pixel in image (or -1 if outside)
+                      for(size_t j=0; j<n; ++j)
+                        {
+                          const int px = int(std::round(px_rel[j]/pars.pixsize + imgcen.x));
+                          const int py = int(std::round(py_rel[j]/pars.pixsize + imgcen.y));
+                          pix[j] = (px>=0 && px<xw && py>=0 && py<yw) ? py*xw+px : -1;
+                        }
+
+                      // add to pixels
+                      for(size_t j=0; j<n; ++j)
+                        if(pix[j] >= 0)
+                          img.arr[pix[j]] += 1;
+                    }
+                }
+
+              if(writer)
+                for(size_t j=0; j<n; ++j)
+                  for(size_t p=0; p != poses.size(); ++p)
+                    {
+                      evts_out.push_back({relx[p*n+j], rely[p*n+j], events.getPI(batch.sel[j])});
+                      if(evts_out.size() >= blocksize)
+                        {
+                          writer->submit(chunk.seq, std::move(evts_out), false);
+                          evts_out = std::vector<EventOut>();
+                          evts_out.reserve(blocksize);
+                        }
+                    }
+
+              gstart = gend;
+            } // groups
+
+          bstart = bend;
+        } // blocks
+
+      // remaining events for chunk
+      if(writer)
+        {
+          writer->submit(chunk.seq, std::move(evts_out), true);
+          evts_out = std::vector<EventOut>();
+          evts_out.reserve(blocksize);
+        }
+
+    } // chunks
+}
+
+void projectEvents(const Pars& pars, const EventTable& events,
+                   const std::vector<SourceVisibility>& vis,
+                   const std::vector<SourceTrack>& tracks,
+                   const GTITable& gti, const AttitudeTable& att,
+                   const Mask& mask, const InstPar& instpar,
+                   Image<int>* img, EventWriter* writer)
+{
+  // Split events where any source is visible into chunks. Each event
+  // is processed once, for all the sources.
+  std::vector<Chunk> chunks;
+  {
+    const size_t chunk_size = pars.threads <= 1 ? 16384 : 400;
+    std::vector<std::pair<size_t,size_t>> ranges;
+    for(auto [first, last] : anyVisibleRanges(vis, events))
+      for(size_t i=first; i < last; i += chunk_size)
+        ranges.emplace_back(i, std::min(i+chunk_size, last));
+
+    // only the sources which may be visible are checked for each chunk
+    auto srcs = rangeSources(vis, events, ranges);
+    for(size_t i=0; i != ranges.size(); ++i)
+      chunks.push_back({ranges[i].first, ranges[i].second-ranges[i].first,
+            std::move(srcs[i]), i});
+
+    // we want it reversed, as vector processing starts from the end
+    std::reverse(chunks.begin(), chunks.end());
+  }
+
+  std::mutex mutex;
+
+  pars.withProjMode([&](const auto& projmode)
+  {
+    using Mode = std::decay_t<decltype(projmode)>;
+    if(pars.threads <= 1)
+      {
+        processEvents<Mode>(chunks, mutex,
+                            events, vis, tracks, projmode,
+                            pars, gti, att, mask, instpar, img, writer);
+      }
+    else
+      {
+        std::vector<std::thread> threads;
+        for(unsigned i=0; i != pars.threads; ++i)
+          threads.emplace_back(processEvents<Mode>,
+                               std::ref(chunks), std::ref(mutex),
+                               std::cref(events), std::cref(vis), std::cref(tracks),
+                               projmode, pars, gti, att, mask, instpar,
+                               img, writer);
+        for(auto& thread : threads)
+          thread.join();
+      }
+  });
+}
@@ -0,0 +1,25 @@
+#ifndef EVENT_PROJ_HH
+#define EVENT_PROJ_HH
+
+#include <vector>
+
+#include "event_writer.hh"
+#include "image.hh"
+#include "pars.hh"
+#include "source_track.hh"
+#include "visibility.hh"
+
+// Project the events during the times where each source is visible,
+// processing each event once for all the sources. If img is not null,
+// the counts are added to the image. If writer is not null, the
+// projected events are submitted to it, with each chunk of events
+// using its time order as its sequence number. Events are in time
+// order within each chunk, then in order of source index.
+void projectEvents(const Pars& pars, const EventTable& events,
+                   const std::vector<SourceVisibility>& vis,
+                   const std::vector<SourceTrack>& tracks,
+                   const GTITable& gti, const AttitudeTable& att,
+                   const Mask& mask, const InstPar& instpar,
+                   Image<int>* img, EventWriter* writer);
+
+#endif
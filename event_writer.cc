@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "common.hh"
+#include "event_writer.hh"
+
+EventWriter::EventWriter(fitsfile* _ff, bool _ordered, size_t _maxqueued)
+  : ff(_ff), ordered(_ordered), maxqueued(std::max(_maxqueued, size_t(1))),
+    blocksize(1), nextseq(0), numqueued(0), done(false), numrows(0)
+{
+  int status = 0;
+
+  // make table
+  int tfields = 3;
+  const char *ttype[] = {"DX", "DY", "PI"};
+  const char *tform[] = {"E", "E", "E"};
+  const char *tunit[] = {"PIX", "PIX", ""};
+
+  fits_insert_btbl(ff, 0, tfields, const_cast<char**>(ttype), const_cast<char**>(tform),
+                   const_cast<char**>(tunit), "EROEVT", 0, &status);
+  check_fitsio_status(status);
+
+  long nrows;
+  fits_get_rowsize(ff, &nrows, &status);
+  check_fitsio_status(status);
+  blocksize = size_t(std::max(nrows, 1L));
+  vals.reserve(blocksize);
+
+  thread = std::thread(&EventWriter::writerLoop, this);
+}
+
+EventWriter::~EventWriter()
+{
+  if(thread.joinable())
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+      }
+      cond.notify_all();
+      thread.join();
+    }
+}
+
+void EventWriter::submit(size_t seq, std::vector<EventOut>&& block, bool last)
+{
+  if(!ordered)
+    {
+      if(block.empty())
+        return;
+      seq = 0;
+    }
+
+  std::unique_lock<std::mutex> lock(mutex);
+
+  // Wait if too many blocks are queued. The blocks for the next
+  // sequence number can always be written, so they only wait for
+  // each other.
+  cond.wait(lock, [&]()
+            {
+              if(seq == nextseq)
+                {
+                  auto it = pending.find(seq);
+                  return it == pending.end() || it->second.blocks.size() < maxqueued;
+                }
+              return numqueued < maxqueued;
+            });
+
+  Pending& p = pending[seq];
+  if(!block.empty())
+    {
+      p.blocks.push_back(std::move(block));
+      ++numqueued;
+    }
+  if(last)
+    p.last = true;
+
+  lock.unlock();
+  cond.notify_all();
+}
+
+size_t EventWriter::finish()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+  }
+  cond.notify_all();
+  thread.join();
+
+  if(error)
+    std::rethrow_exception(error);
+  if(numqueued != 0 || (ordered && !pending.empty()))
+    throw std::runtime_error("events left unwritten");
+
+  return numrows;
+}
+
+bool EventWriter::haveWritable()
+{
+  for(;;)
+    {
+      auto it = pending.find(nextseq);
+      if(it == pending.end())
+        return false;
+      if(!it->second.blocks.empty())
+        return true;
+      if(!ordered || !it->second.last)
+        return false;
+
+      // all blocks written for this sequence number, so threads
+      // waiting to submit the next may be able to continue
+      pending.erase(it);
+      ++nextseq;
+      cond.notify_all();
+    }
+}
+
+void EventWriter::writerLoop()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  for(;;)
+    {
+      cond.wait(lock, [&]() { return done || haveWritable(); });
+      if(!haveWritable())
+        {
+          if(done)
+            return;
+          continue;
+        }
+
+      Pending& p = pending[nextseq];
+      std::vector<EventOut> block(std::move(p.blocks.front()));
+      p.blocks.pop_front();
+      --numqueued;
+
+      // write without holding lock, so other threads can submit
+      lock.unlock();
+      cond.notify_all();
+      if(!error)
+        {
+          try
+            {
+              writeBlock(block);
+            }
+          catch(std::runtime_error&)
+            {
+              // keep taking blocks so submitting threads do not wait
+              error = std::current_exception();
+            }
+        }
+      lock.lock();
+    }
+}
+
+void EventWriter::writeBlock(const std::vector<EventOut>& block)
+{
+  int status = 0;
+  const long firstrow = long(numrows) + 1;
+
+  // write columns
+  vals.clear();
+  for(const auto& e : block)
+    vals.push_back(e.dx);
+  fits_write_col(ff, TFLOAT, 1, firstrow, 1, vals.size(), &vals[0], &status);
+  vals.clear();
+  for(const auto& e : block)
+    vals.push_back(e.dy);
+  fits_write_col(ff, TFLOAT, 2, firstrow, 1, vals.size(), &vals[0], &status);
+  vals.clear();
+  for(const auto& e : block)
+    vals.push_back(e.pi);
+  fits_write_col(ff, TFLOAT, 3, firstrow, 1, vals.size(), &vals[0], &status);
+  check_fitsio_status(status);
+
+  numrows += block.size();
+}
@@ -0,0 +1,79 @@
+#ifndef EVENT_WRITER_HH
+#define EVENT_WRITER_HH
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fitsio.h>
+
+// event projected relative to a source
+struct EventOut
+{
+  float dx, dy, pi;
+};
+
+// Write projected events to a new EROEVT table in an open file, using
+// a separate thread, so that writing overlaps with projecting the
+// events. Threads submit blocks of events, which are written in the
+// order they arrive, or if ordered, in the order of their sequence
+// numbers. Submitting blocks waits if too many are queued, so the
+// memory used does not depend on the number of events.
+class EventWriter
+{
+public:
+  EventWriter(fitsfile* _ff, bool _ordered, size_t _maxqueued=16);
+  ~EventWriter();
+
+  // number of events to submit in each block (the optimal number
+  // of rows for cfitsio to write)
+  size_t blockSize() const { return blocksize; }
+
+  // Add block of events with sequence number seq. If ordered, the
+  // blocks for a sequence number are written in the order they are
+  // submitted, and last must be set on the final block for each
+  // sequence number (which may be empty), starting from 0.
+  void submit(size_t seq, std::vector<EventOut>&& block, bool last);
+
+  // wait for all the events to be written and return the number of
+  // rows (throws if there was an error writing)
+  size_t finish();
+
+private:
+  struct Pending
+  {
+    std::deque<std::vector<EventOut>> blocks;
+    bool last = false;
+  };
+
+  // remove finished sequence numbers and check for a block to write
+  bool haveWritable();
+  void writerLoop();
+  void writeBlock(const std::vector<EventOut>& block);
+
+private:
+  fitsfile* ff;
+  bool ordered;
+  size_t maxqueued;
+  size_t blocksize;
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  // blocks waiting for each sequence number (just 0 if not ordered)
+  std::map<size_t, Pending> pending;
+  size_t nextseq;
+  size_t numqueued;
+  bool done;
+
+  size_t numrows;
+  std::vector<float> vals;
+  std::exception_ptr error;
+
+  std::thread thread;
+};
+
+#endif
@@ -3,12 +3,32 @@
 #include <cmath>
 #include <cstdio>
 #include <limits>
+#include <numeric>
+#include <stdexcept>
 
 #include "events.hh"
 #include "common.hh"
+#include "detmap.hh"
+#include "table_reader.hh"
 
-EventTable::EventTable(fitsfile *ff)
+// convert detector position to compact layout
+static uint16_t quantCcd(float v)
 {
+  const long q = std::lround(v*EventTable::ccd_scale);
+  return uint16_t(std::clamp(q, 0L, 65535L));
+}
+
+EventTable::EventTable(fitsfile *ff, int tm, float pimin, float pimax,
+                       const GTITable& gti, unsigned cols, bool _compact)
+  : num_entries(0), compact(_compact), time0(0), time_scale(1), ra0(0), dec0(0)
+{
+  if(cols == COL_NONE)
+    return;
+
+  // selected events are inside the GTIs
+  if(compact && gti.num > 0)
+    setTimeRange(gti.start.front(), gti.stop.back());
+
   int status = 0;
 
   std::printf("  - Opening EVENTS extension\n");
@@ -16,122 +36,316 @@ EventTable::EventTable(fitsfile *ff)
 
   long nrows;
   fits_get_num_rows(ff, &nrows, &status);
-
+  // number of rows cfitsio can read efficiently at once
+  long batchrows;
+  fits_get_rowsize(ff, &batchrows, &status);
   check_fitsio_status(status);
+  batchrows = std::max(batchrows, 1L);
+
+  // which columns to read, other than those used for selection
+  const bool keepraw = cols & COL_RAW;
+  const bool keepccd = cols & COL_CCD;
+  const bool keepradec = cols & COL_RADEC;
+  const bool readraw = keepraw || keepccd;
+
+  // reads uncompressed files directly from a memory mapping
+  TableReader table(ff);
+  if(table.mapped())
+    std::printf("    - reading mapped table\n");
 
-  rawx.resize(nrows);
-  rawy.resize(nrows);
-  tm_nr.resize(nrows);
-  ra.resize(nrows);
-  dec.resize(nrows);
-  time.resize(nrows);
-  pi.resize(nrows);
-  subx.resize(nrows);
-  suby.resize(nrows);
-
-  // read in table
-  read_fits_column(ff, "RAWX", TSHORT, nrows, &rawx[0]);
-  read_fits_column(ff, "RAWY", TSHORT, nrows, &rawy[0]);
-  read_fits_column(ff, "TM_NR", TSHORT, nrows, &tm_nr[0]);
-  read_fits_column(ff, "RA", TDOUBLE, nrows, &ra[0]);
-  read_fits_column(ff, "DEC", TDOUBLE, nrows, &dec[0]);
-  read_fits_column(ff, "TIME", TDOUBLE, nrows, &time[0]);
-  read_fits_column(ff, "PI", TFLOAT, nrows, &pi[0]);
-  read_fits_column(ff, "SUBX", TFLOAT, nrows, &subx[0]);
-  read_fits_column(ff, "SUBY", TFLOAT, nrows, &suby[0]);
-
-  // unsigned init_size = rawx.size();
-  // for(size_t i=0; i<20000000; ++i)
-  //   {
-  //     rawx.push_back( rand() % 384 + 1);
-  //     rawy.push_back( rand() % 384 + 1);
-  //     tm_nr.push_back(2);
-  //     ra.push_back(0);
-  //     dec.push_back(0);
-  //     time.push_back(time[rand() % nrows]);
-  //     pi.push_back(1000);
-  //     subx.push_back( (rand()*1./RAND_MAX) - 0.5 );
-  //     suby.push_back( (rand()*1./RAND_MAX) - 0.5 );
-  //   }
-  // nrows = rawx.size();
-
-  // for(unsigned i=0; i<init_size; ++i)
-  //   {
-  //     tm_nr[i] = 999;
-  //   }
-
-  // combine rawx/y and subx/y
-  ccdx.reserve(nrows); ccdy.reserve(nrows);
-  for(long i=0; i<nrows; ++i)
+  const int c_tm_nr = table.column("TM_NR");
+  const int c_time = table.column("TIME");
+  const int c_pi = table.column("PI");
+  const int c_rawx = readraw ? table.column("RAWX") : 0;
+  const int c_rawy = readraw ? table.column("RAWY") : 0;
+  const int c_subx = keepccd ? table.column("SUBX") : 0;
+  const int c_suby = keepccd ? table.column("SUBY") : 0;
+  const int c_ra = keepradec ? table.column("RA") : 0;
+  const int c_dec = keepradec ? table.column("DEC") : 0;
+
+  // columns for each batch of rows
+  std::vector<short> b_tm_nr(batchrows);
+  std::vector<double> b_time(batchrows);
+  std::vector<float> b_pi(batchrows);
+  std::vector<short> b_rawx, b_rawy;
+  std::vector<float> b_subx, b_suby;
+  std::vector<double> b_ra, b_dec;
+  if(readraw)
+    {
+      b_rawx.resize(batchrows);
+      b_rawy.resize(batchrows);
+    }
+  if(keepccd)
     {
-      ccdx.push_back(rawx[i]+subx[i]);
-      ccdy.push_back(rawy[i]+suby[i]);
+      b_subx.resize(batchrows);
+      b_suby.resize(batchrows);
+    }
+  if(keepradec)
+    {
+      b_ra.resize(batchrows);
+      b_dec.resize(batchrows);
     }
 
-  // sort entries by time (normally sorted anyway)
-  std::vector<size_t> sort_idx = argsort(time);
-  do_filter(sort_idx);
+  std::vector<float> b_ccdx, b_ccdy;
+  if(keepccd)
+    {
+      b_ccdx.resize(batchrows);
+      b_ccdy.resize(batchrows);
+    }
+
+  std::vector<size_t> sel;
+  bool sorted = true;
+  double lasttime = -std::numeric_limits<double>::infinity();
+
+  // Read the table in batches of rows, only keeping the rows for the
+  // TM, PI range and GTIs. The other columns are only read for
+  // batches with rows to keep.
+  for(long first=0; first < nrows; first += batchrows)
+    {
+      const long n = std::min(batchrows, nrows-first);
+      table.read(c_tm_nr, TSHORT, first, n, &b_tm_nr[0]);
+      table.read(c_pi, TFLOAT, first, n, &b_pi[0]);
+      table.read(c_time, TDOUBLE, first, n, &b_time[0]);
+
+      sel.clear();
+      for(long i=0; i<n; ++i)
+        if(b_tm_nr[i]==tm && b_pi[i]>=pimin && b_pi[i]<pimax &&
+           gti.contains(b_time[i]))
+          sel.push_back(i);
+      if(sel.empty())
+        continue;
+
+      for(size_t i : sel)
+        {
+          if(b_time[i] < lasttime)
+            sorted = false;
+          lasttime = b_time[i];
+        }
+
+      EventColumns batch{&b_time[0], &b_pi[0]};
+      if(readraw)
+        {
+          table.read(c_rawx, TSHORT, first, n, &b_rawx[0]);
+          table.read(c_rawy, TSHORT, first, n, &b_rawy[0]);
+          batch.rawx = &b_rawx[0];
+          batch.rawy = &b_rawy[0];
+        }
+      if(keepccd)
+        {
+          // combine rawx/y and subx/y
+          table.read(c_subx, TFLOAT, first, n, &b_subx[0]);
+          table.read(c_suby, TFLOAT, first, n, &b_suby[0]);
+          for(size_t i : sel)
+            {
+              b_ccdx[i] = b_rawx[i]+b_subx[i];
+              b_ccdy[i] = b_rawy[i]+b_suby[i];
+            }
+          batch.ccdx = &b_ccdx[0];
+          batch.ccdy = &b_ccdy[0];
+        }
+      if(keepradec)
+        {
+          table.read(c_ra, TDOUBLE, first, n, &b_ra[0]);
+          table.read(c_dec, TDOUBLE, first, n, &b_dec[0]);
+          batch.ra = &b_ra[0];
+          batch.dec = &b_dec[0];
+        }
+
+      append(batch, sel, cols);
+    }
+  num_entries = compact ? time_q.size() : time.size();
 
   std::printf("    - successfully read %ld entries\n", nrows);
+  std::printf("    - selected TM%d, PI=%g:%g and GTIs, giving %ld entries\n",
+              tm, pimin, pimax, num_entries);
+  if(compact)
+    std::printf("    - using compact layout\n");
+
+  // sort entries by time (normally sorted anyway)
+  if(!sorted)
+    {
+      std::vector<size_t> sort_idx = compact ? argsort(time_q) : argsort(time);
+      do_filter(sort_idx);
+      std::printf("    - sorted by time\n");
+    }
 }
 
-void EventTable::filter_tm(int tm)
+EventTable::EventTable(const EventColumns& columns, size_t num,
+                       unsigned cols, bool _compact)
+  : num_entries(0), compact(_compact), time0(0), time_scale(1), ra0(0), dec0(0)
 {
-  std::vector<size_t> idxs;
-  for(size_t i=0; i != rawx.size(); ++i)
-    if(tm_nr[i] == tm)
-      idxs.push_back(i);
+  if(cols == COL_NONE)
+    return;
 
-  do_filter(idxs);
-  std::printf("    - filtered to TM%d, giving %ld entries\n", tm, num_entries);
+  if(compact && num > 0)
+    {
+      auto [tmin, tmax] = std::minmax_element(columns.time, columns.time+num);
+      setTimeRange(*tmin, *tmax);
+    }
+
+  // append in batches to avoid a large selection
+  const size_t batchsize = 65536;
+  std::vector<size_t> sel;
+  for(size_t first=0; first < num; first += batchsize)
+    {
+      const size_t n = std::min(batchsize, num-first);
+      sel.resize(n);
+      std::iota(sel.begin(), sel.end(), first);
+      append(columns, sel, cols);
+    }
+  num_entries = compact ? time_q.size() : time.size();
 }
 
-void EventTable::filter_pi(float pimin, float pimax)
+void EventTable::setTimeRange(double tmin, double tmax)
 {
-  std::vector<size_t> idxs;
-  for(size_t i=0; i != rawx.size(); ++i)
-    if(pi[i]>=pimin && pi[i]<pimax)
-      idxs.push_back(i);
+  // use the smallest power of two seconds, down to 2^-20 s, for the
+  // ticks to fit in 32 bits. The rounding is well below the 50 ms
+  // frame time for ranges up to several years.
+  time0 = tmin;
+  time_scale = std::ldexp(1., -20);
+  while((tmax-tmin) / time_scale > double(std::numeric_limits<uint32_t>::max()))
+    time_scale *= 2;
+}
 
-  do_filter(idxs);
-  std::printf("    - filtered from PI=%g:%g, giving %ld entries\n",
-              pimin, pimax, num_entries);
+size_t EventTable::lowerBound(double t, size_t first) const
+{
+  size_t lo = first, hi = num_entries;
+  while(lo < hi)
+    {
+      const size_t mid = lo + (hi-lo)/2;
+      if(getTime(mid) < t)
+        lo = mid+1;
+      else
+        hi = mid;
+    }
+  return lo;
 }
 
-void EventTable::filter_gti(const GTITable& gti)
+size_t EventTable::upperBound(double t, size_t first) const
 {
-  // assumes events are time ordered
-  std::vector<size_t> idxs;
-  size_t gtii = 0;
-  for(size_t i=0; i != rawx.size(); ++i)
+  size_t lo = first, hi = num_entries;
+  while(lo < hi)
     {
-      double t = time[i];
-      while(gtii<gti.num && t>gti.stop[gtii])
-        ++gtii;
-      if(gtii == gti.num)
-        break;
-      if(t >= gti.start[gtii])
-        idxs.push_back(i);
+      const size_t mid = lo + (hi-lo)/2;
+      if(getTime(mid) <= t)
+        lo = mid+1;
+      else
+        hi = mid;
     }
+  return lo;
+}
+
+void EventTable::append(const EventColumns& c, const std::vector<size_t>& sel,
+                        unsigned cols)
+{
+  if(compact)
+    for(size_t i : sel)
+      {
+        const double q = std::round((c.time[i]-time0) / time_scale);
+        time_q.push_back(uint32_t(std::clamp(q, 0., double(std::numeric_limits<uint32_t>::max()))));
+      }
+  else
+    for(size_t i : sel)
+      time.push_back(c.time[i]);
+
+  if(cols & COL_PI)
+    for(size_t i : sel)
+      {
+        if(compact)
+          pi_q.push_back(uint16_t(std::clamp(std::lround(c.pi[i]), 0L, 65535L)));
+        else
+          pi.push_back(c.pi[i]);
+      }
+
+  if(cols & COL_RAW)
+    for(size_t i : sel)
+      {
+        rawx.push_back(c.rawx[i]);
+        rawy.push_back(c.rawy[i]);
+      }
+
+  if(cols & COL_CCD)
+    for(size_t i : sel)
+      {
+        if(compact)
+          {
+            ccdx_q.push_back(quantCcd(c.ccdx[i]));
+            ccdy_q.push_back(quantCcd(c.ccdy[i]));
+          }
+        else
+          {
+            ccdx.push_back(c.ccdx[i]);
+            ccdy.push_back(c.ccdy[i]);
+          }
+      }
+
+  if(cols & COL_RADEC)
+    for(size_t i : sel)
+      {
+        if(compact)
+          {
+            // offsets from the first event
+            if(dra.empty())
+              {
+                ra0 = c.ra[i];
+                dec0 = c.dec[i];
+              }
+            double off = c.ra[i] - ra0;
+            off = off < -180 ? off+360 : off >= 180 ? off-360 : off;
+            dra.push_back(float(off));
+            ddec.push_back(float(c.dec[i] - dec0));
+          }
+        else
+          {
+            ra.push_back(c.ra[i]);
+            dec.push_back(c.dec[i]);
+          }
+      }
+}
+
+void EventTable::filter_badpix(DetMap& detmap)
+{
+  if(rawx.size() != num_entries)
+    throw std::runtime_error("raw event coordinates not loaded");
+
+  // events are time ordered, so the map is only rebuilt when the bad
+  // pixel table changes
+  std::vector<size_t> idxs;
+  for(size_t i=0; i != num_entries; ++i)
+    if( detmap.getMap(getTime(i))(rawx[i]-1, rawy[i]-1) != 0.f )
+      idxs.push_back(i);
+
+  // raw coordinates are not needed after this
+  rawx = std::vector<short>();
+  rawy = std::vector<short>();
 
   do_filter(idxs);
-  std::printf("    - filtered GTIs, giving %ld entries\n",
+  std::printf("    - filtered bad pixels, giving %ld entries\n",
               num_entries);
 }
 
-// filter all columns to have indices given
+// filter all kept columns to have indices given
 void EventTable::do_filter(const std::vector<size_t>& sel)
 {
-  rawx = selidx(rawx, sel);
-  rawy = selidx(rawy, sel);
-  tm_nr = selidx(tm_nr, sel);
-  ra = selidx(ra, sel);
-  dec = selidx(dec, sel);
-  time = selidx(time, sel);
-  pi = selidx(pi, sel);
-  subx = selidx(subx, sel);
-  suby = selidx(suby, sel);
-  ccdx = selidx(ccdx, sel);
-  ccdy = selidx(ccdy, sel);
-  num_entries = rawx.size();
+  auto filt = [&sel](auto& col)
+  {
+    if(!col.empty())
+      col = selidx(col, sel);
+  };
+
+  filt(rawx);
+  filt(rawy);
+  filt(ra);
+  filt(dec);
+  filt(time);
+  filt(time_q);
+  filt(pi);
+  filt(ccdx);
+  filt(ccdy);
+  filt(ccdx_q);
+  filt(ccdy_q);
+  filt(pi_q);
+  filt(dra);
+  filt(ddec);
+  num_entries = compact ? time_q.size() : time.size();
 }
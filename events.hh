@@ -1,30 +1,142 @@
 #ifndef EVENTS_HH
 #define EVENTS_HH
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <fitsio.h>
 
 #include "gti.hh"
 
+class DetMap;
+
+// pointers to columns of events (null if not available)
+struct EventColumns
+{
+  const double* time = nullptr;
+  const float* pi = nullptr;
+  const short *rawx = nullptr, *rawy = nullptr;
+  const float *ccdx = nullptr, *ccdy = nullptr;
+  const double *ra = nullptr, *dec = nullptr;
+};
+
 class EventTable
 {
 public:
-  EventTable(fitsfile *ff);
-  void filter_tm(int tm);
-  void filter_pi(float pimin, float pimax);
-  void filter_gti(const GTITable& gti);
+  // columns to keep in the table, in addition to the time (if
+  // none are given, no events are read)
+  enum columns : unsigned {
+    COL_NONE = 0,
+    COL_RAW = 1,     // rawx, rawy (for filtering bad pixels)
+    COL_CCD = 2,     // ccdx, ccdy
+    COL_RADEC = 4,   // ra, dec
+    COL_PI = 8,      // pi
+  };
+
+  // read events for TM with pimin<=PI<pimax, inside the GTIs,
+  // reading and keeping only the columns needed. If compact, the
+  // columns are stored in the compact layout (see below).
+  EventTable(fitsfile *ff, int tm, float pimin, float pimax,
+             const GTITable& gti, unsigned cols, bool compact=false);
+
+  // copy num time-ordered events from the columns given, keeping
+  // the columns in cols
+  EventTable(const EventColumns& columns, size_t num,
+             unsigned cols, bool compact=false);
+
+  // remove events on bad pixels (the raw coordinates are then dropped)
+  void filter_badpix(DetMap& detmap);
+
+  // get index after the last event from start (before end) with a
+  // time within tol of the event at start (events are time sorted)
+  size_t groupEnd(size_t start, size_t end, double tol) const
+  {
+    const double tmax = getTime(start) + tol;
+    size_t i = start+1;
+    while(i < end && getTime(i) <= tmax)
+      ++i;
+    return i;
+  }
+
+  // index of first event from first with time >= t (lowerBound) or
+  // time > t (upperBound)
+  size_t lowerBound(double t, size_t first=0) const;
+  size_t upperBound(double t, size_t first=0) const;
+
+  // whether sky positions were loaded
+  bool hasSky() const { return !ra.empty() || !dra.empty(); }
+
+  // time and PI of event (in either layout)
+  double getTime(size_t i) const
+  {
+    return compact ? time0 + time_q[i]*time_scale : time[i];
+  }
+  float getPI(size_t i) const
+  {
+    return compact ? float(pi_q[i]) : pi[i];
+  }
+
+  // get detector positions of n events from start
+  void decodeCcd(size_t start, size_t n, float* x, float* y) const
+  {
+    if(compact)
+      {
+        const uint16_t* qx = &ccdx_q[start];
+        const uint16_t* qy = &ccdy_q[start];
+        for(size_t i=0; i<n; ++i)
+          {
+            x[i] = qx[i]*(1.f/ccd_scale);
+            y[i] = qy[i]*(1.f/ccd_scale);
+          }
+      }
+    else
+      {
+        std::copy(&ccdx[start], &ccdx[start]+n, x);
+        std::copy(&ccdy[start], &ccdy[start]+n, y);
+      }
+  }
+
+  // get sky positions of n events from start (compact layout)
+  void decodeSky(size_t start, size_t n, double* r, double* d) const
+  {
+    for(size_t i=0; i<n; ++i)
+      {
+        double tr = ra0 + dra[start+i];
+        r[i] = tr < 0 ? tr+360 : tr >= 360 ? tr-360 : tr;
+        d[i] = dec0 + ddec[start+i];
+      }
+  }
 
 private:
+  // append events with indices sel in the columns, keeping cols
+  void append(const EventColumns& c, const std::vector<size_t>& sel,
+              unsigned cols);
+  // set time0 and time_scale for events from tmin to tmax
+  void setTimeRange(double tmin, double tmax);
   void do_filter(const std::vector<size_t>& sel);
 
 public:
+  // columns which are not kept are empty
   size_t num_entries;
-  std::vector<short> rawx, rawy, tm_nr;
+  std::vector<short> rawx, rawy;
   std::vector<double> ra, dec, time;
-  std::vector<float> pi, subx, suby;
+  std::vector<float> pi;
 
   // combined rawx+subx, rawy+suby
   std::vector<float> ccdx, ccdy;
+
+  // In the compact layout, time_q, ccdx_q, ccdy_q, pi_q, dra and
+  // ddec are used instead of time, ccdx, ccdy, pi, ra and dec. Times
+  // are ticks of time_scale seconds from time0, detector positions
+  // are in units of 1/ccd_scale pixels, PI is rounded to an integer
+  // and sky positions are offsets in degrees from ra0, dec0.
+  bool compact;
+  static constexpr float ccd_scale = 128;
+  std::vector<uint32_t> time_q;
+  double time0, time_scale;
+  std::vector<uint16_t> ccdx_q, ccdy_q, pi_q;
+  std::vector<float> dra, ddec;
+  double ra0, dec0;
 };
 
 #endif
@@ -0,0 +1,456 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include "expos_area.hh"
+#include "common.hh"
+#include "geom.hh"
+
+namespace
+{
+  // is q inside (or on) the edge p1->p2 of a polygon with positive area?
+  inline bool edgeInside(Point p1, Point p2, Point q)
+  {
+    return (p2.x-p1.x)*(q.y-p1.y) - (p2.y-p1.y)*(q.x-p1.x) <= 0;
+  }
+
+  // is point inside convex quadrilateral with positive area?
+  inline bool insideQuad(const Poly& quad, Point q)
+  {
+    return edgeInside(quad[3], quad[0], q) && edgeInside(quad[0], quad[1], q) &&
+      edgeInside(quad[1], quad[2], q) && edgeInside(quad[2], quad[3], q);
+  }
+
+  // square pixel centred on x,y, ordered to give positive area
+  inline void pixelSquare(float x, float y, Poly& sq)
+  {
+    sq[0] = Point(x-0.5f, y-0.5f);
+    sq[1] = Point(x-0.5f, y+0.5f);
+    sq[2] = Point(x+0.5f, y+0.5f);
+    sq[3] = Point(x+0.5f, y-0.5f);
+  }
+
+  // Sum of detector map multiplied by area of overlap with the
+  // quadrilateral (in detector coordinates, where pixel i covers
+  // i+0.5 to i+1.5). The area used for each detector pixel is
+  // overlaparea(overlap, area), given the overlap polygon and its
+  // area. sq and clipped are working space.
+  template<class OverlapArea>
+  double detOverlapSum(const Image<float>& dmimg, const Poly& quad,
+                       Poly& sq, Poly& clipped, OverlapArea overlaparea)
+  {
+    const Rect b = quad.bounds();
+    const int ilo = std::max(int(std::floor(b.tl.x-0.5f)), 0);
+    const int ihi = std::min(int(std::floor(b.br.x-0.5f)), int(CCD_XW)-1);
+    const int jlo = std::max(int(std::floor(b.tl.y-0.5f)), 0);
+    const int jhi = std::min(int(std::floor(b.br.y-0.5f)), int(CCD_YW)-1);
+
+    double sum = 0;
+    for(int j=jlo; j<=jhi; ++j)
+      for(int i=ilo; i<=ihi; ++i)
+        {
+          const float val = dmimg(i, j);
+          if(val == 0)
+            continue;
+
+          pixelSquare(i+1, j+1, sq);
+          if(insideQuad(quad, sq[0]) && insideQuad(quad, sq[1]) &&
+             insideQuad(quad, sq[2]) && insideQuad(quad, sq[3]))
+            {
+              // pixel completely covered
+              sum += val * overlaparea(sq, 1.);
+            }
+          else if(b.tl.x >= i+0.5f && b.br.x <= i+1.5f &&
+                  b.tl.y >= j+0.5f && b.br.y <= j+1.5f)
+            {
+              // quadrilateral inside pixel
+              sum += val * overlaparea(quad, quad.area());
+            }
+          else
+            {
+              poly_clip(sq, quad, clipped);
+              sum += val * overlaparea(clipped, std::abs(clipped.area()));
+            }
+        }
+    return sum;
+  }
+
+  // parts of mask polygons clipped to an output pixel
+  struct MaskPieces
+  {
+    // pixel index, and range of points in pts for each piece
+    struct Piece
+    {
+      int idx;
+      unsigned first, num;
+    };
+    std::vector<Piece> pieces;
+    std::vector<Point> pts;
+
+    void clear() { pieces.clear(); pts.clear(); }
+  };
+
+  // Mark output pixels completely covered by polygon in cover, and
+  // keep the part of the polygon covering other pixels in the range
+  // given, so overlapping polygons can be combined
+  void addMaskPieces(const Poly& poly, Image<float>& cover, MaskPieces& mp,
+                     int minx, int maxx, int miny, int maxy)
+  {
+    const Rect b = poly.bounds();
+    const int xlo = std::max(int(std::floor(b.tl.x+0.5f)), minx);
+    const int xhi = std::min(int(std::floor(b.br.x+0.5f)), maxx);
+    const int ylo = std::max(int(std::floor(b.tl.y+0.5f)), miny);
+    const int yhi = std::min(int(std::floor(b.br.y+0.5f)), maxy);
+
+    Poly sq(4), clipped;
+    for(int y=ylo; y<=yhi; ++y)
+      for(int x=xlo; x<=xhi; ++x)
+        {
+          if(cover(x, y) >= 1)
+            continue;
+          pixelSquare(x, y, sq);
+          poly_clip(poly, sq, clipped);
+          const float area = std::abs(clipped.area());
+          if(area >= 1)
+            cover(x, y) = 1;
+          else if(area > 0)
+            {
+              mp.pieces.push_back({y*int(cover.xw)+x, unsigned(mp.pts.size()),
+                    unsigned(clipped.size())});
+              mp.pts.insert(mp.pts.end(), clipped.pts.begin(), clipped.pts.end());
+            }
+        }
+  }
+
+  // Area of the union of n pieces (which may overlap), from
+  // the length covered along vertical lines. Between the x
+  // coordinates of the vertices and edge intersections, the covered
+  // length is linear in x, so it is exact to use the slab centre.
+  double unionArea(const MaskPieces& mp, const MaskPieces::Piece* pieces, size_t n)
+  {
+    struct Edge { double x1, y1, x2, y2; };
+    std::vector<Edge> edges;
+    std::vector<size_t> edgestart;
+    std::vector<double> xs;
+    for(size_t i=0; i != n; ++i)
+      {
+        edgestart.push_back(edges.size());
+        const Point* p = &mp.pts[pieces[i].first];
+        const unsigned np = pieces[i].num;
+        for(unsigned j=0; j != np; ++j)
+          {
+            const Point a = p[j==0 ? np-1 : j-1];
+            const Point b = p[j];
+            edges.push_back({a.x, a.y, b.x, b.y});
+            xs.push_back(b.x);
+          }
+      }
+    edgestart.push_back(edges.size());
+
+    // x where edges cross
+    for(size_t i=0; i != edges.size(); ++i)
+      for(size_t j=i+1; j != edges.size(); ++j)
+        {
+          const Edge& e = edges[i];
+          const Edge& f = edges[j];
+          const double dex = e.x2-e.x1, dey = e.y2-e.y1;
+          const double dfx = f.x2-f.x1, dfy = f.y2-f.y1;
+          const double den = dex*dfy - dey*dfx;
+          if(den == 0)
+            continue;
+          const double u = ((f.x1-e.x1)*dfy - (f.y1-e.y1)*dfx) / den;
+          const double v = ((f.x1-e.x1)*dey - (f.y1-e.y1)*dex) / den;
+          if(u > 0 && u < 1 && v > 0 && v < 1)
+            xs.push_back(e.x1 + u*dex);
+        }
+    std::sort(xs.begin(), xs.end());
+
+    double area = 0;
+    std::vector<double> ys;
+    std::vector<std::pair<double,double>> ivs;
+    for(size_t k=0; k+1 < xs.size(); ++k)
+      {
+        const double w = xs[k+1]-xs[k];
+        if(w <= 0)
+          continue;
+        const double xm = 0.5*(xs[k]+xs[k+1]);
+
+        // intervals inside each piece along x=xm
+        ivs.clear();
+        for(size_t i=0; i != n; ++i)
+          {
+            ys.clear();
+            for(size_t ei=edgestart[i]; ei != edgestart[i+1]; ++ei)
+              {
+                const Edge& e = edges[ei];
+                if((e.x1 < xm) != (e.x2 < xm))
+                  ys.push_back(e.y1 + (xm-e.x1)*(e.y2-e.y1)/(e.x2-e.x1));
+              }
+            std::sort(ys.begin(), ys.end());
+            for(size_t j=0; j+1 < ys.size(); j += 2)
+              ivs.emplace_back(ys[j], ys[j+1]);
+          }
+
+        // length of union of intervals
+        std::sort(ivs.begin(), ivs.end());
+        double len = 0;
+        double lo = 0, hi = 0;
+        bool have = false;
+        for(auto& iv : ivs)
+          {
+            if(have && iv.first <= hi)
+              hi = std::max(hi, iv.second);
+            else
+              {
+                if(have)
+                  len += hi-lo;
+                lo = iv.first;
+                hi = iv.second;
+                have = true;
+              }
+          }
+        if(have)
+          len += hi-lo;
+
+        area += len*w;
+      }
+    return area;
+  }
+
+  // Set the masked fraction of the pixels with pieces in cover, using
+  // the area of their union, so overlapping masks are not counted
+  // twice. The pieces are left sorted by pixel index.
+  void combineMaskPieces(MaskPieces& mp, Image<float>& cover)
+  {
+    std::stable_sort(mp.pieces.begin(), mp.pieces.end(),
+                     [](const MaskPieces::Piece& a, const MaskPieces::Piece& b)
+                     { return a.idx < b.idx; });
+
+    for(size_t i=0; i != mp.pieces.size(); )
+      {
+        const int idx = mp.pieces[i].idx;
+        size_t j = i+1;
+        while(j != mp.pieces.size() && mp.pieces[j].idx == idx)
+          ++j;
+
+        float& c = cover.arr[idx];
+        if(c < 1)
+          {
+            if(j == i+1)
+              {
+                Poly piece;
+                piece.pts.assign(mp.pts.begin()+mp.pieces[i].first,
+                                 mp.pts.begin()+mp.pieces[i].first+mp.pieces[i].num);
+                c = std::abs(piece.area());
+              }
+            else
+              c = float(unionArea(mp, &mp.pieces[i], j-i));
+          }
+        i = j;
+      }
+  }
+
+  // Area of the part of the overlap polygon (in output pixel
+  // coordinates, with positive area) covered by the n mask pieces.
+  // work and clipped are working space.
+  double maskedOverlapArea(const Poly& overlap, const MaskPieces& mp,
+                           const MaskPieces::Piece* pieces, size_t n,
+                           MaskPieces& work, Poly& clipped)
+  {
+    work.clear();
+    Poly piece;
+    for(size_t i=0; i != n; ++i)
+      {
+        piece.pts.assign(mp.pts.begin()+pieces[i].first,
+                         mp.pts.begin()+pieces[i].first+pieces[i].num);
+        poly_clip(piece, overlap, clipped);
+        if(clipped.size() < 3)
+          continue;
+        work.pieces.push_back({0, unsigned(work.pts.size()), unsigned(clipped.size())});
+        work.pts.insert(work.pts.end(), clipped.pts.begin(), clipped.pts.end());
+      }
+
+    if(work.pieces.empty())
+      return 0;
+    if(work.pieces.size() == 1)
+      {
+        piece.pts.assign(work.pts.begin(), work.pts.end());
+        return std::abs(piece.area());
+      }
+    return unionArea(work, &work.pieces[0], work.pieces.size());
+  }
+
+  void processArea(TimeSegQueue& queue, std::mutex& mutex,
+                   Pars pars, AttitudeTable att, DetMap detmap,
+                   Mask mask, InstPar instpar, DeadCorTable deadc,
+                   Image<double>& finalimg)
+  {
+    PlanState state(pars, att, deadc);
+    auto& projmode = state.projmode;
+    CoordConv coordconv(instpar);
+    const Point imgcen = pars.imageCentre();
+    const int xw = pars.xw;
+    const int yw = pars.yw;
+
+    std::vector<TimeSeg> batch;
+
+    // output image
+    Image<double> img(xw, yw, 0.);
+
+    // fraction of each pixel masked during time step
+    Image<float> cover(xw, yw, 0.f);
+    MaskPieces maskpieces, workpieces;
+
+    Poly quad(4), sq(4), clipped, outoverlap, maskclipped;
+
+    while(queue.next(batch, state))
+      {
+        for(const TimeSeg& timeseg : batch)
+          {
+            auto [att_ra, att_dec, att_roll] = state.att.interpolate(timeseg.t);
+            coordconv.updatePointing(att_ra, att_dec, att_roll);
+
+            Point srcccd(timeseg.src_ccdx, timeseg.src_ccdy);
+            Point delpt = srcccd - Point(instpar.x_ref, instpar.y_ref);
+            Point projorigin = projmode->origin(srcccd);
+
+            // matrix to go from detector -> image, including pixel size
+            auto mat = projmode->rotationMatrix(timeseg.roll, delpt);
+            mat.scale(1/pars.pixsize);
+
+            // matrix to go from image -> detector, including pixel size
+            auto matrev = projmode->rotationMatrix(-timeseg.roll, delpt);
+            matrev.scale(pars.pixsize);
+
+            // bounding box of detector pixel edges in output image
+            float bxlo=1e30f, bxhi=-1e30f, bylo=1e30f, byhi=-1e30f;
+            for(Point c : {Point(0.5f,0.5f), Point(CCD_XW+0.5f,0.5f),
+                  Point(0.5f,CCD_YW+0.5f), Point(CCD_XW+0.5f,CCD_YW+0.5f)})
+              {
+                Point ic = mat.apply(c - projorigin) + imgcen;
+                bxlo = std::min(bxlo, ic.x); bxhi = std::max(bxhi, ic.x);
+                bylo = std::min(bylo, ic.y); byhi = std::max(byhi, ic.y);
+              }
+            const int minx = std::max(int(std::floor(bxlo))-1, 0);
+            const int maxx = std::min(int(std::ceil(bxhi))+1, xw-1);
+            const int miny = std::max(int(std::floor(bylo))-1, 0);
+            const int maxy = std::min(int(std::ceil(byhi))+1, yw-1);
+            if(minx > maxx || miny > maxy)
+              continue;
+
+            const Image<float>& dmimg = detmap.getMap(timeseg.t);
+
+            // get masked fraction of each pixel
+            PolyVec maskedpolys(mask.as_ccd_poly(coordconv));
+            applyShiftRotationShift(maskedpolys, mat, projorigin, imgcen);
+            for(auto& poly : maskedpolys)
+              addMaskPieces(poly, cover, maskpieces, minx, maxx, miny, maxy);
+            combineMaskPieces(maskpieces, cover);
+
+            // corners of output pixels are mapped onto the detector
+            // in this order, which needs swapping if the matrix flips
+            // the orientation
+            const bool flip = matrev.m00*matrev.m11 - matrev.m01*matrev.m10 < 0;
+            const float dx[4] = {-0.5f, -0.5f, 0.5f, 0.5f};
+            const float dy[4] = {-0.5f, 0.5f, 0.5f, -0.5f};
+
+            // the whole area of each overlap is used without masks
+            auto wholearea = [](const Poly&, double area) { return area; };
+
+            const float dt = timeseg.dt;
+            size_t piecei = 0;
+            for(int y=miny; y<=maxy; ++y)
+              for(int x=minx; x<=maxx; ++x)
+                {
+                  const float masked = std::min(cover(x,y), 1.f);
+                  cover(x,y) = 0;
+
+                  // mask pieces for pixel (sorted by pixel index)
+                  const int idx = y*xw+x;
+                  while(piecei != maskpieces.pieces.size() &&
+                        maskpieces.pieces[piecei].idx < idx)
+                    ++piecei;
+                  size_t piecej = piecei;
+                  while(piecej != maskpieces.pieces.size() &&
+                        maskpieces.pieces[piecej].idx == idx)
+                    ++piecej;
+
+                  if(masked >= 1)
+                    continue;
+
+                  for(int i=0; i<4; ++i)
+                    {
+                      Point pix(x+dx[i], y+dy[i]);
+                      quad[flip ? 3-i : i] = matrev.apply(pix-imgcen) + projorigin;
+                    }
+                  const float area = quad.area();
+                  if(area <= 0)
+                    continue;
+
+                  if(piecej == piecei)
+                    {
+                      const double sum = detOverlapSum(dmimg, quad, sq, clipped, wholearea);
+                      img(x,y) += sum / area * dt;
+                      continue;
+                    }
+
+                  // Partly masked: remove the masked part of the overlap
+                  // with each detector pixel, as the detector map may
+                  // change inside the output pixel
+                  auto unmaskedarea = [&](const Poly& overlap, double ovarea)
+                    {
+                      outoverlap.clear();
+                      for(Point p : overlap.pts)
+                        outoverlap.add(mat.apply(p - projorigin) + imgcen);
+                      if(outoverlap.area() < 0)
+                        std::reverse(outoverlap.pts.begin(), outoverlap.pts.end());
+                      const double outarea = std::abs(outoverlap.area());
+                      if(outarea <= 0)
+                        return 0.;
+                      const double maskedarea =
+                        maskedOverlapArea(outoverlap, maskpieces, &maskpieces.pieces[piecei],
+                                          piecej-piecei, workpieces, maskclipped);
+                      return ovarea * std::max(1 - maskedarea/outarea, 0.);
+                    };
+                  const double sum = detOverlapSum(dmimg, quad, sq, clipped, unmaskedarea);
+                  img(x,y) += sum / area * dt;
+                }
+            maskpieces.clear();
+          } // segments in batch
+      } // batches
+
+    // add our part to the total
+    std::lock_guard<std::mutex> lock(mutex);
+    finalimg.arr += img.arr;
+  }
+
+} // namespace
+
+void areaTimeSegs(TimeSegQueue& queue,
+                  const Pars& pars, const AttitudeTable& att,
+                  const DetMap& detmap, const Mask& mask,
+                  const InstPar& instpar, const DeadCorTable& deadc,
+                  Image<double>& sumimg)
+{
+  std::printf("  - computing exact pixel overlaps\n");
+
+  std::mutex mutex;
+
+  if(pars.threads <= 1)
+    {
+      processArea(queue, mutex, pars, att, detmap, mask, instpar, deadc, sumimg);
+    }
+  else
+    {
+      std::vector<std::thread> threads;
+      for(unsigned i=0; i != pars.threads; ++i)
+        threads.emplace_back(processArea,
+                             std::ref(queue), std::ref(mutex),
+                             pars, att, detmap, mask, instpar, deadc,
+                             std::ref(sumimg));
+      for(auto& thread : threads)
+        thread.join();
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef EXPOS_AREA_HH
+#define EXPOS_AREA_HH
+
+#include "expos_plan.hh"
+#include "image.hh"
+#include "pars.hh"
+
+// Make exposure map where each output pixel is the mean of the
+// detector map over the area of the pixel, using the fractional
+// overlap of the pixel with each detector pixel. Masked fractions of
+// pixels are removed.
+void areaTimeSegs(TimeSegQueue& queue,
+                  const Pars& pars, const AttitudeTable& att,
+                  const DetMap& detmap, const Mask& mask,
+                  const InstPar& instpar, const DeadCorTable& deadc,
+                  Image<double>& sumimg);
+
+#endif
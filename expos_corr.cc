@@ -0,0 +1,427 @@
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+
+#include "expos_corr.hh"
+#include "common.hh"
+#include "coords.hh"
+#include "poly_fill.hh"
+
+namespace
+{
+  typedef std::complex<double> cplx;
+
+  // time step with quantized source position (in output pixels)
+  struct HistSeg
+  {
+    double t, src_ra, src_dec;
+    int kx, ky;
+    float dt;
+  };
+
+  // all the time steps during a bad pixel epoch
+  struct Epoch
+  {
+    std::vector<HistSeg> segs;
+    std::map<std::tuple<int,int>, double> hist;
+  };
+
+  // detector map resampled onto output pixel grid, so that
+  // value(m) = detmap(floor(m*pixsize-0.5)), for m from mlo, matching
+  // the rounding of detector coordinates in the raster method
+  struct ResampDetMap
+  {
+    ResampDetMap(const Image<float>& dm, float pixsize)
+      : mlox(lowIndex(pixsize)), mloy(lowIndex(pixsize)),
+        img(highIndex(pixsize, CCD_XW)-mlox+1, highIndex(pixsize, CCD_YW)-mloy+1)
+    {
+      for(unsigned y=0; y<img.yw; ++y)
+        {
+          int dy = int(std::floor((int(y)+mloy)*pixsize-0.5f));
+          for(unsigned x=0; x<img.xw; ++x)
+            {
+              int dx = int(std::floor((int(x)+mlox)*pixsize-0.5f));
+              img(x,y) = dm(dx, dy);
+            }
+        }
+    }
+
+    // first m with valid detector pixel
+    static int lowIndex(float pixsize)
+    {
+      int m = int(std::ceil(0.5f/pixsize));
+      while(std::floor((m-1)*pixsize-0.5f) >= 0)
+        --m;
+      while(std::floor(m*pixsize-0.5f) < 0)
+        ++m;
+      return m;
+    }
+
+    // last m with valid detector pixel
+    static int highIndex(float pixsize, unsigned w)
+    {
+      int m = int(std::floor((w+0.5f)/pixsize));
+      while(std::floor(m*pixsize-0.5f) >= int(w))
+        --m;
+      while(std::floor((m+1)*pixsize-0.5f) < int(w))
+        ++m;
+      return m;
+    }
+
+    int mlox, mloy;
+    Image<float> img;
+  };
+
+  // in-place radix-2 complex FFT (size must be a power of 2)
+  void fft1d(std::vector<cplx>& a, const std::vector<cplx>& twiddle, bool inverse)
+  {
+    const size_t n = a.size();
+
+    // bit reversal permutation
+    for(size_t i=1, j=0; i<n; ++i)
+      {
+        size_t bit = n >> 1;
+        for(; j & bit; bit >>= 1)
+          j ^= bit;
+        j ^= bit;
+        if(i < j)
+          std::swap(a[i], a[j]);
+      }
+
+    // twiddle has n/2 entries, exp(-2 pi i k/n)
+    for(size_t len=2; len<=n; len <<= 1)
+      {
+        const size_t step = n/len;
+        for(size_t i=0; i<n; i+=len)
+          for(size_t j=0; j<len/2; ++j)
+            {
+              cplx w = twiddle[j*step];
+              if(inverse)
+                w = std::conj(w);
+              cplx u = a[i+j];
+              cplx v = a[i+j+len/2]*w;
+              a[i+j] = u+v;
+              a[i+j+len/2] = u-v;
+            }
+      }
+  }
+
+  std::vector<cplx> makeTwiddle(size_t n)
+  {
+    std::vector<cplx> tw(n/2);
+    for(size_t k=0; k<n/2; ++k)
+      tw[k] = std::polar(1., -2*PI*double(k)/double(n));
+    return tw;
+  }
+
+  // 2D FFT of array nx*ny (row major)
+  void fft2d(std::vector<cplx>& a, size_t nx, size_t ny, bool inverse)
+  {
+    std::vector<cplx> twx = makeTwiddle(nx);
+    std::vector<cplx> twy = makeTwiddle(ny);
+
+    std::vector<cplx> tmp(nx);
+    for(size_t y=0; y<ny; ++y)
+      {
+        std::copy(&a[y*nx], &a[y*nx]+nx, tmp.begin());
+        fft1d(tmp, twx, inverse);
+        std::copy(tmp.begin(), tmp.end(), &a[y*nx]);
+      }
+    tmp.resize(ny);
+    for(size_t x=0; x<nx; ++x)
+      {
+        for(size_t y=0; y<ny; ++y)
+          tmp[y] = a[y*nx+x];
+        fft1d(tmp, twy, inverse);
+        for(size_t y=0; y<ny; ++y)
+          a[y*nx+x] = tmp[y];
+      }
+
+    if(inverse)
+      {
+        const double norm = 1./(double(nx)*double(ny));
+        for(auto& v : a)
+          v *= norm;
+      }
+  }
+
+  size_t next_pow2(size_t v)
+  {
+    size_t n = 1;
+    while(n < v)
+      n <<= 1;
+    return n;
+  }
+
+  // add correlation of histogram with detector map directly
+  void correlateDirect(const Epoch& epoch, const ResampDetMap& rdm,
+                       int icx, int icy, unsigned nthreads,
+                       Image<double>& outimg)
+  {
+    const int xw = outimg.xw;
+    const int yw = outimg.yw;
+    const int dxw = rdm.img.xw;
+    const int dyw = rdm.img.yw;
+
+    std::vector<std::tuple<int,int,double>> bins;
+    for(auto& [k, w] : epoch.hist)
+      bins.emplace_back(std::get<0>(k), std::get<1>(k), w);
+
+    // each thread does a set of rows, so no locking is required
+    auto dorows = [&](int ystart, int ystep)
+      {
+        for(auto& [kx, ky, w] : bins)
+          {
+            const int ox = kx - icx - rdm.mlox;
+            const int oy = ky - icy - rdm.mloy;
+            const int xlo = std::max(0, -ox);
+            const int xhi = std::min(xw, dxw-ox);
+            for(int y=ystart; y<yw; y+=ystep)
+              {
+                const int my = y + oy;
+                if(my < 0 || my >= dyw)
+                  continue;
+                const float* dptr = &rdm.img.arr[my*dxw];
+                double* optr = &outimg.arr[y*xw];
+                for(int x=xlo; x<xhi; ++x)
+                  optr[x] += w * dptr[x+ox];
+              }
+          }
+      };
+
+    if(nthreads <= 1)
+      dorows(0, 1);
+    else
+      {
+        std::vector<std::thread> threads;
+        for(unsigned i=0; i != nthreads; ++i)
+          threads.emplace_back(dorows, int(i), int(nthreads));
+        for(auto& thread : threads)
+          thread.join();
+      }
+  }
+
+  // add correlation of histogram with detector map using FFT
+  void correlateFFT(const Epoch& epoch, const ResampDetMap& rdm,
+                    int khlox, int khloy, int lenhx, int lenhy,
+                    int icx, int icy, Image<double>& outimg)
+  {
+    const int dxw = rdm.img.xw;
+    const int dyw = rdm.img.yw;
+
+    const size_t nx = next_pow2(size_t(dxw + lenhx - 1));
+    const size_t ny = next_pow2(size_t(dyw + lenhy - 1));
+
+    std::vector<cplx> hist(nx*ny, 0.), det(nx*ny, 0.);
+    for(auto& [k, w] : epoch.hist)
+      hist[(std::get<1>(k)-khloy)*nx + (std::get<0>(k)-khlox)] = w;
+    for(int y=0; y<dyw; ++y)
+      for(int x=0; x<dxw; ++x)
+        det[y*nx+x] = rdm.img(x, y);
+
+    fft2d(hist, nx, ny, false);
+    fft2d(det, nx, ny, false);
+    for(size_t i=0; i != nx*ny; ++i)
+      det[i] *= std::conj(hist[i]);
+    fft2d(det, nx, ny, true);
+
+    // corr(a) = sum_j hist(j) det(j+a), where the output pixel x
+    // corresponds to a = x - icx + khlox - mlox
+    for(int y=0; y<int(outimg.yw); ++y)
+      {
+        const int ay = y - icy + khloy - rdm.mloy;
+        if(ay < -(lenhy-1) || ay > dyw-1)
+          continue;
+        const size_t wy = size_t((ay + int(ny)) % int(ny));
+        for(int x=0; x<int(outimg.xw); ++x)
+          {
+            const int ax = x - icx + khlox - rdm.mlox;
+            if(ax < -(lenhx-1) || ax > dxw-1)
+              continue;
+            const size_t wx = size_t((ax + int(nx)) % int(nx));
+            outimg(x, y) += det[wy*nx + wx].real();
+          }
+      }
+  }
+
+  // subtract exposure for masked regions during each time step
+  void subtractMasks(const std::vector<HistSeg>& segs,
+                     size_t start, size_t step,
+                     const ResampDetMap& rdm, const Pars& pars,
+                     AttitudeTable att, const Mask& mask,
+                     const InstPar& instpar, Image<double>& outimg)
+  {
+    CoordConv coordconv(instpar);
+    const Point imgcen = pars.imageCentre();
+    const int icx = int(imgcen.x);
+    const int icy = int(imgcen.y);
+    const int xw = outimg.xw;
+    const int yw = outimg.yw;
+    const int dxw = rdm.img.xw;
+    const int dyw = rdm.img.yw;
+
+    Matrix2 mat;
+    mat.scale(1/pars.pixsize);
+
+    // union of masks during time step
+    Image<float> maskimg(pars.xw, pars.yw, 0.f);
+
+    for(size_t i=start; i<segs.size(); i+=step)
+      {
+        const HistSeg& seg = segs[i];
+        auto [att_ra, att_dec, att_roll] = att.interpolate(seg.t);
+        coordconv.updatePointing(att_ra, att_dec, att_roll);
+
+        // place the masks relative to the quantized source position,
+        // so they line up with the correlation
+        PolyVec maskedpolys(mask.as_ccd_poly(coordconv));
+        Point origin(seg.kx*pars.pixsize, seg.ky*pars.pixsize);
+        applyShiftRotationShift(maskedpolys, mat, origin, imgcen);
+
+        int bxlo=xw, bxhi=-1, bylo=yw, byhi=-1;
+        for(auto& poly : maskedpolys)
+          {
+            Rect b = poly.bounds();
+            if(b.br.x < 0 || b.br.y < 0 || b.tl.x > xw-1 || b.tl.y > yw-1)
+              continue;
+            fillPoly(poly, maskimg, 1.f);
+            bxlo = std::min(bxlo, std::max(int(std::floor(b.tl.x)), 0));
+            bxhi = std::max(bxhi, std::min(int(std::ceil(b.br.x)), xw-1));
+            bylo = std::min(bylo, std::max(int(std::floor(b.tl.y)), 0));
+            byhi = std::max(byhi, std::min(int(std::ceil(b.br.y)), yw-1));
+          }
+
+        const int ox = seg.kx - icx - rdm.mlox;
+        const int oy = seg.ky - icy - rdm.mloy;
+        for(int y=bylo; y<=byhi; ++y)
+          for(int x=bxlo; x<=bxhi; ++x)
+            {
+              float& mval = maskimg.arr[y*xw+x];
+              if(mval == 0.f)
+                continue;
+              mval = 0.f;
+              const int mx = x + ox;
+              const int my = y + oy;
+              if(mx>=0 && my>=0 && mx<dxw && my<dyw)
+                outimg.arr[y*xw+x] -= double(seg.dt) * rdm.img(mx, my);
+            }
+      }
+  }
+
+} // namespace
+
+void exposCorrelate(const Pars& pars, const std::vector<TimeSeg>& timesegs,
+                    const AttitudeTable& att_in, const DetMap& detmap_in,
+                    const Mask& mask, const InstPar& instpar,
+                    Image<double>& sumimg)
+{
+  auto projmode = pars.createProjMode();
+  if(projmode->hasRotation())
+    throw std::runtime_error("Correlation exposure method requires a projection without rotation");
+
+  std::printf("  - computing exposure by correlation\n");
+
+  AttitudeTable att(att_in);
+  DetMap detmap(detmap_in);
+
+  // build histogram of quantized source positions for each epoch
+  std::map<int, Epoch> epochs;
+  for(auto& ts : timesegs)
+    {
+      Point projorigin = projmode->origin(Point(ts.src_ccdx, ts.src_ccdy));
+
+      int kx = int(std::floor(projorigin.x/pars.pixsize + 0.5f));
+      int ky = int(std::floor(projorigin.y/pars.pixsize + 0.5f));
+
+      Epoch& epoch = epochs[detmap.epochIndex(ts.t)];
+      epoch.segs.push_back({ts.t, ts.src_ra, ts.src_dec, kx, ky, ts.dt});
+      epoch.hist[std::make_tuple(kx, ky)] += ts.dt;
+    }
+
+  const Point imgcen = pars.imageCentre();
+  const int icx = int(imgcen.x);
+  const int icy = int(imgcen.y);
+  const bool hasmask = !mask.empty();
+  const unsigned nthreads = std::max(pars.threads, 1u);
+
+  for(auto& [epochidx, epoch] : epochs)
+    {
+      const double t0 = epoch.segs[0].t;
+      ResampDetMap rdm(pars.prefilter ?
+                       detmap.getFilteredMap(t0, pars.pixsize) : detmap.getMap(t0),
+                       pars.pixsize);
+
+      // get extent of histogram
+      int khlox = std::numeric_limits<int>::max();
+      int khloy = std::numeric_limits<int>::max();
+      int khhix = std::numeric_limits<int>::min();
+      int khhiy = std::numeric_limits<int>::min();
+      for(auto& [k, w] : epoch.hist)
+        {
+          khlox = std::min(khlox, std::get<0>(k));
+          khhix = std::max(khhix, std::get<0>(k));
+          khloy = std::min(khloy, std::get<1>(k));
+          khhiy = std::max(khhiy, std::get<1>(k));
+        }
+      const int lenhx = khhix-khlox+1;
+      const int lenhy = khhiy-khloy+1;
+
+      // estimate cost of direct and FFT methods and choose cheapest
+      const double npix = double(rdm.img.xw) * rdm.img.yw;
+      const double costdirect = double(epoch.hist.size()) * npix / nthreads;
+      const double nfft = double(next_pow2(rdm.img.xw+lenhx-1)) *
+        double(next_pow2(rdm.img.yw+lenhy-1));
+      const double costfft = 3 * 5 * nfft * std::log2(nfft);
+      const bool usefft = costfft < costdirect;
+
+      std::printf("    - epoch %d: %ld time steps, %ld histogram bins (%s)\n",
+                  epochidx, epoch.segs.size(), epoch.hist.size(),
+                  usefft ? "fft" : "direct");
+
+      if(usefft)
+        correlateFFT(epoch, rdm, khlox, khloy, lenhx, lenhy, icx, icy, sumimg);
+      else
+        correlateDirect(epoch, rdm, icx, icy, nthreads, sumimg);
+
+      if(!hasmask)
+        continue;
+
+      // remove masked regions, splitting time steps between threads
+      if(nthreads <= 1)
+        subtractMasks(epoch.segs, 0, 1, rdm, pars, att, mask, instpar, sumimg);
+      else
+        {
+          std::vector<Image<double>> threadimgs(nthreads, Image<double>(pars.xw, pars.yw, 0.));
+          std::vector<std::thread> threads;
+          for(unsigned i=0; i != nthreads; ++i)
+            threads.emplace_back(subtractMasks, std::cref(epoch.segs), i, nthreads,
+                                 std::cref(rdm), std::cref(pars), att,
+                                 std::cref(mask), std::cref(instpar),
+                                 std::ref(threadimgs[i]));
+          for(auto& thread : threads)
+            thread.join();
+          for(auto& img : threadimgs)
+            sumimg.arr += img.arr;
+        }
+    }
+
+  // remove rounding errors from FFT, which should be tiny compared
+  // to the exposure, so larger negative values indicate a problem
+  double maxv = 0;
+  for(double v : sumimg.arr)
+    maxv = std::max(maxv, v);
+  const double tol = 1e-6 * maxv;
+  for(auto& v : sumimg.arr)
+    if(v < 0)
+      {
+        if(v < -tol)
+          throw std::runtime_error("Negative exposure after correlation");
+        v = 0;
+      }
+}
@@ -0,0 +1,20 @@
+#ifndef EXPOS_CORR_HH
+#define EXPOS_CORR_HH
+
+#include <vector>
+
+#include "image.hh"
+#include "pars.hh"
+#include "timeseg.hh"
+
+// Make exposure map for projections without rotation. The unmasked
+// map is the correlation of the detector map with the time-weighted
+// histogram of source positions (in output pixels), computed for
+// each bad pixel epoch either directly or by FFT. Masked regions are
+// then subtracted for each time step.
+void exposCorrelate(const Pars& pars, const std::vector<TimeSeg>& timesegs,
+                    const AttitudeTable& att, const DetMap& detmap,
+                    const Mask& mask, const InstPar& instpar,
+                    Image<double>& sumimg);
+
+#endif
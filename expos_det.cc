@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "expos_det.hh"
+#include "common.hh"
+#include "geom.hh"
+#include "poly_fill.hh"
+
+namespace
+{
+  // total time in a bad pixel epoch
+  struct EpochTime
+  {
+    double t = 0;       // a time inside the epoch
+    double sumdt = 0;   // total time
+  };
+
+  typedef std::map<int, EpochTime> EpochTimes;
+
+  // Get index of detector pixel for each output pixel (or -1 if off
+  // the detector), rounding as in the raster method
+  std::vector<int> detectorIndices(const Pars& pars, const Matrix2& matrev,
+                                   Point projorigin)
+  {
+    const Point imgcen = pars.imageCentre();
+    std::vector<int> idx(pars.xw*pars.yw);
+    for(int y=0; y<int(pars.yw); ++y)
+      for(int x=0; x<int(pars.xw); ++x)
+        {
+          Point det = matrev.apply(Point(x,y)-imgcen) + projorigin;
+          int dix = int(det.x+(16.f-0.5f))-16;
+          int diy = int(det.y+(16.f-0.5f))-16;
+          if(dix>=0 && diy>=0 && dix<int(CCD_XW) && diy<int(CCD_YW))
+            idx[y*pars.xw+x] = diy*CCD_XW+dix;
+          else
+            idx[y*pars.xw+x] = -1;
+        }
+    return idx;
+  }
+
+  const Image<float>& mapForTime(const Pars& pars, DetMap& detmap, double t)
+  {
+    return pars.prefilter ? detmap.getFilteredMap(t, pars.pixsize) : detmap.getMap(t);
+  }
+
+  // detector pixel indices for the fixed projection
+  std::vector<int> projectionIndices(const Pars& pars)
+  {
+    // the projection is fixed, so use any pose
+    auto projmode = pars.createProjMode();
+    auto matrev = projmode->rotationMatrix(0, Point(0,0));
+    matrev.scale(pars.pixsize);
+    return detectorIndices(pars, matrev, projmode->origin(Point(0,0)));
+  }
+
+  // add the detector map for each epoch, weighted by its time
+  void addEpochMaps(const Pars& pars, const DetMap& detmap,
+                    const std::vector<int>& detidx, const EpochTimes& times,
+                    Image<double>& sumimg)
+  {
+    DetMap dm(detmap);
+    std::vector<double> detexpos(CCD_XW*CCD_YW, 0.);
+    for(auto& [epochidx, et] : times)
+      {
+        const Image<float>& dmimg = mapForTime(pars, dm, et.t);
+        for(size_t i=0; i != detexpos.size(); ++i)
+          detexpos[i] += dmimg.arr[i] * et.sumdt;
+      }
+    std::printf("  - %ld bad pixel epochs\n", times.size());
+
+    for(size_t i=0; i != detidx.size(); ++i)
+      if(detidx[i] >= 0)
+        sumimg.arr[i] += detexpos[detidx[i]];
+  }
+
+  // dead time correction at t, held constant outside the table
+  double deadcAt(const DeadCorTable& deadc, double t)
+  {
+    auto it = std::upper_bound(deadc.time.begin(), deadc.time.end(), t);
+    if(it == deadc.time.begin())
+      return deadc.deadc.front();
+    if(it == deadc.time.end())
+      return deadc.deadc.back();
+    const size_t i = it - deadc.time.begin();
+    const double f = (t - deadc.time[i-1]) / (deadc.time[i] - deadc.time[i-1]);
+    return deadc.deadc[i-1]*(1-f) + deadc.deadc[i]*f;
+  }
+
+  // integral of the linearly interpolated dead time correction
+  // between ta and tb
+  double integrateDeadc(const DeadCorTable& deadc, double ta, double tb)
+  {
+    double sum = 0;
+    double t0 = ta;
+    double v0 = deadcAt(deadc, ta);
+    for(auto it = std::upper_bound(deadc.time.begin(), deadc.time.end(), ta);
+        it != deadc.time.end() && *it < tb; ++it)
+      {
+        const double v1 = deadc.deadc[it - deadc.time.begin()];
+        sum += 0.5*(v0+v1)*(*it-t0);
+        t0 = *it;
+        v0 = v1;
+      }
+    sum += 0.5*(v0+deadcAt(deadc, tb))*(tb-t0);
+    return sum;
+  }
+
+  // sum time in each epoch, and subtract the masked detector map for
+  // each time step
+  void processDet(TimeSegQueue& queue, std::mutex& mutex,
+                  Pars pars, AttitudeTable att, DetMap detmap,
+                  Mask mask, InstPar instpar, DeadCorTable deadc,
+                  const std::vector<int>& detidx,
+                  EpochTimes& finaltimes, Image<double>& finalimg)
+  {
+    PlanState state(pars, att, deadc);
+    auto& projmode = state.projmode;
+    CoordConv coordconv(instpar);
+    const Point imgcen = pars.imageCentre();
+    const int xw = pars.xw;
+    const bool hasmask = !mask.empty();
+
+    std::vector<TimeSeg> batch;
+    EpochTimes times;
+    Image<double> img(pars.xw, pars.yw, 0.);
+
+    while(queue.next(batch, state))
+      {
+        for(const TimeSeg& timeseg : batch)
+          {
+            EpochTime& et = times[detmap.epochIndex(timeseg.t)];
+            et.t = timeseg.t;
+            et.sumdt += timeseg.dt;
+
+            if(!hasmask)
+              continue;
+
+            auto [att_ra, att_dec, att_roll] = state.att.interpolate(timeseg.t);
+            coordconv.updatePointing(att_ra, att_dec, att_roll);
+
+            Point srcccd(timeseg.src_ccdx, timeseg.src_ccdy);
+            Point delpt = srcccd - Point(instpar.x_ref, instpar.y_ref);
+            Point projorigin = projmode->origin(srcccd);
+
+            // matrix to go from detector -> image, including pixel size
+            auto mat = projmode->rotationMatrix(timeseg.roll, delpt);
+            mat.scale(1/pars.pixsize);
+
+            PolyVec maskedpolys(mask.as_ccd_poly(coordconv));
+            applyShiftRotationShift(maskedpolys, mat, projorigin, imgcen);
+            const PolySpans maskspans(maskedpolys, pars.xw, pars.yw);
+
+            // remove masked parts for this time step
+            const Image<float>& dmimg = mapForTime(pars, detmap, timeseg.t);
+            const float dt = timeseg.dt;
+            for(int y=0; y<int(pars.yw); ++y)
+              {
+                const Span* spans = maskspans.spans(y);
+                for(int i=0; i<maskspans.numSpans(y); ++i)
+                  for(int x=spans[i].x1; x<=spans[i].x2; ++x)
+                    {
+                      const int di = detidx[y*xw+x];
+                      if(di >= 0)
+                        img.arr[y*xw+x] -= dmimg.arr[di] * dt;
+                    }
+              }
+          } // segments in batch
+      } // batches
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& [epochidx, et] : times)
+      {
+        EpochTime& fet = finaltimes[epochidx];
+        fet.t = et.t;
+        fet.sumdt += et.sumdt;
+      }
+    finalimg.arr += img.arr;
+  }
+
+} // namespace
+
+void exposDetAnalytic(TimeSegQueue& queue,
+                      const Pars& pars, const AttitudeTable& att,
+                      const DetMap& detmap, const Mask& mask,
+                      const InstPar& instpar, const DeadCorTable& deadc,
+                      Image<double>& sumimg)
+{
+  std::printf("  - summing detector map over bad pixel epochs\n");
+
+  const std::vector<int> detidx = projectionIndices(pars);
+
+  EpochTimes times;
+  std::mutex mutex;
+
+  if(pars.threads <= 1)
+    {
+      processDet(queue, mutex, pars, att, detmap, mask, instpar, deadc,
+                 detidx, times, sumimg);
+    }
+  else
+    {
+      std::vector<std::thread> threads;
+      for(unsigned i=0; i != pars.threads; ++i)
+        threads.emplace_back(processDet,
+                             std::ref(queue), std::ref(mutex),
+                             pars, att, detmap, mask, instpar, deadc,
+                             std::cref(detidx), std::ref(times),
+                             std::ref(sumimg));
+      for(auto& thread : threads)
+        thread.join();
+    }
+
+  addEpochMaps(pars, detmap, detidx, times, sumimg);
+}
+
+void exposDetIntegrate(const Pars& pars,
+                       const std::vector<SourceVisibility>& vis,
+                       const DetMap& detmap, const DeadCorTable& deadc,
+                       Image<double>& sumimg)
+{
+  std::printf("  - integrating visible time over bad pixel epochs\n");
+
+  const std::vector<double>& tedge = detmap.epochEdges();
+
+  // the visible intervals are within the GTIs, and split at the
+  // epoch edges, tedge[i] < t <= tedge[i+1]
+  EpochTimes times;
+  for(const SourceVisibility& srcvis : vis)
+    for(size_t i=0; i != srcvis.start.size(); ++i)
+      {
+        const double ta = srcvis.start[i];
+        const double tb = srcvis.stop[i];
+        for(int ei = detmap.epochIndex(ta);
+            ei+1 < int(tedge.size()) && tedge[ei] < tb; ++ei)
+          {
+            const double lo = std::max(ta, tedge[ei]);
+            const double hi = std::min(tb, tedge[ei+1]);
+            if(hi <= lo)
+              continue;
+            EpochTime& et = times[ei];
+            et.t = 0.5*(lo+hi);
+            et.sumdt += integrateDeadc(deadc, lo, hi);
+          }
+      }
+
+  addEpochMaps(pars, detmap, projectionIndices(pars), times, sumimg);
+}
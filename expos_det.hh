@@ -0,0 +1,28 @@
+#ifndef EXPOS_DET_HH
+#define EXPOS_DET_HH
+
+#include "expos_plan.hh"
+#include "image.hh"
+#include "pars.hh"
+#include "visibility.hh"
+
+// Make exposure map for the det projection, where the detector does
+// not move in the output image. The time in each bad pixel epoch is
+// summed, and the detector map for each epoch is projected once,
+// weighted by this time. Masks, which move, are subtracted for each
+// time step. This gives the same result as the raster method.
+void exposDetAnalytic(TimeSegQueue& queue,
+                      const Pars& pars, const AttitudeTable& att,
+                      const DetMap& detmap, const Mask& mask,
+                      const InstPar& instpar, const DeadCorTable& deadc,
+                      Image<double>& sumimg);
+
+// Make exposure map for the det projection when there are no masks.
+// The dead time corrected visible time of each source is integrated
+// exactly over each bad pixel epoch, without planning time steps.
+void exposDetIntegrate(const Pars& pars,
+                       const std::vector<SourceVisibility>& vis,
+                       const DetMap& detmap, const DeadCorTable& deadc,
+                       Image<double>& sumimg);
+
+#endif
@@ -3,21 +3,21 @@
 #include <mutex>
 #include <stdexcept>
 #include <thread>
+#include <type_traits>
 
 #include "expos_mode.hh"
 #include "common.hh"
 #include "geom.hh"
 #include "coords.hh"
+#include "expos_area.hh"
+#include "expos_corr.hh"
+#include "expos_det.hh"
+#include "expos_plan.hh"
 #include "image.hh"
 #include "poly_fill.hh"
-
-struct TimeSeg
-{
-  double src_ra, src_dec;
-  size_t idx;
-  double t;
-  float dt;
-};
+#include "pose_bin.hh"
+#include "resample.hh"
+#include "timeseg.hh"
 
 // min and max of 4 values
 static inline float min4(float a, float b, float c, float d)
@@ -36,127 +36,238 @@ static inline bool rectoverlap(int ax1, int ax2, int ay1, int ay2,
   return ax1<=bx2 && ax2>=bx1 && ay2>=by1 && ay1<=by2;
 }
 
-static void processGTIs(size_t num,
-                        std::vector<TimeSeg>& times,
+// Find range of pixels xlo to xhi (clamped to minx to maxx) on row y
+// of the output image which could map onto the detector. This uses a
+// margin of a pixel, so that pixels on the edge are left for the
+// resampling to decide. If footprint is set, the margin also includes
+// the extent of each output pixel's footprint on the detector.
+static bool detectorRowRange(const Matrix2& matrev, Point imgcen, Point projorigin,
+                             int y, int minx, int maxx, bool footprint,
+                             int& xlo, int& xhi)
+{
+  // half extent of output pixel on the detector, and extra output
+  // pixels to include for it (as the footprint is at most sqrt(2)
+  // output pixels across)
+  const double fx = footprint ? 0.5*(std::abs(matrev.m00)+std::abs(matrev.m01)) : 0;
+  const double fy = footprint ? 0.5*(std::abs(matrev.m10)+std::abs(matrev.m11)) : 0;
+  const int pad = footprint ? 2 : 1;
+
+  double x1 = minx-pad, x2 = maxx+pad;
+
+  // restrict range of x so that a*x+b lies between the detector edges
+  auto restrict = [&](double a, double b, double detw, double marg)
+    {
+      const double lo = -1.5-marg, hi = detw+0.5+marg;
+      if(a == 0)
+        {
+          if(b < lo || b > hi)
+            x2 = x1-1;
+        }
+      else
+        {
+          double r1 = (lo-b)/a, r2 = (hi-b)/a;
+          if(r1 > r2)
+            std::swap(r1, r2);
+          x1 = std::max(x1, r1);
+          x2 = std::min(x2, r2);
+        }
+    };
+
+  const double py = double(y) - imgcen.y;
+  restrict(matrev.m00, -imgcen.x*matrev.m00 + py*matrev.m01 + projorigin.x, CCD_XW, fx);
+  restrict(matrev.m10, -imgcen.x*matrev.m10 + py*matrev.m11 + projorigin.y, CCD_YW, fy);
+  if(x1 > x2)
+    return false;
+
+  xlo = std::max(int(std::floor(x1))-pad, minx);
+  xhi = std::min(int(std::ceil(x2))+pad, maxx);
+  return xlo <= xhi;
+}
+
+// Set outrow for output pixels xlo to xhi on row y to the mean of
+// the detector map over each pixel's footprint on the detector (zero
+// off the detector), so pixels on the detector edge are partly covered
+static void footprintRow(const SummedArea& dmsat, float* outrow,
+                         int xlo, int xhi, int y, const Matrix2& matrev,
+                         Point imgcen, Point projorigin)
+{
+  for(int x=xlo; x<=xhi; ++x)
+    {
+      // detector pixel i covers coordinates i+0.5 to i+1.5
+      const Point det = matrev.apply(Point(x,y) - imgcen) + projorigin;
+      outrow[x] = float(dmsat.footprintMean(det.x-0.5, det.y-0.5, matrev));
+    }
+}
+
+// this is specialized for each projection mode class
+template<class Mode>
+static void processGTIs(TimeSegQueue& queue,
                         std::mutex& mutex,
+                        Mode projmode,
                         Pars pars, GTITable gti, AttitudeTable att,
                         DetMap detmap,
-                        Mask mask, InstPar instpar,
+                        Mask mask, InstPar instpar, DeadCorTable deadc,
                         Image<double>& finalimg)
 {
-  auto projmode = pars.createProjMode();
+  PlanState state(pars, att, deadc);
   CoordConv coordconv(instpar);
   Point imgcen = pars.imageCentre();
+  const ResampleRowFunc resampleRow = selectResampleRow();
+  const bool footprint = pars.prefilter && pars.pixsize > 1;
+
+  // time segments to process
+  std::vector<TimeSeg> batch;
 
   // output image
   Image<double> img(pars.xw, pars.yw, 0.);
 
-  // image during time step
-  Image<float> imgt(pars.xw, pars.yw, 0.f);
+  // detector values along row during time step
+  std::vector<float> rowvals(pars.xw);
+
+  // spans of pixels to accumulate in row
+  SpanVec spans;
 
-  for(;;)
+  while(queue.next(batch, state))
     {
-      // get next time to process
-      TimeSeg timeseg;
-      {
-        std::lock_guard<std::mutex> lock(mutex);
-        if(times.empty())
-          {
-            // add our part to the total and return
-            finalimg.arr += img.arr;
-            return;
-          }
-        timeseg = times.back();
-        times.pop_back();
-      }
-      auto [att_ra, att_dec, att_roll] = att.interpolate(timeseg.t);
-      coordconv.updatePointing(att_ra, att_dec, att_roll);
-
-      // get ccd coordinates of source
-      auto [src_ccdx, src_ccdy] = coordconv.radec2ccd(timeseg.src_ra, timeseg.src_dec);
-
-      Point srcccd(src_ccdx, src_ccdy);
-      Point delpt = srcccd - Point(instpar.x_ref, instpar.y_ref);
-      Point projorigin = projmode->origin(srcccd);
-
-      // matrix to go from detector -> image, including pixel size
-      auto mat = projmode->rotationMatrix(att_roll, delpt);
-      mat.scale(1/pars.pixsize);
-
-      // matrix to go from image -> detector, including pixel size
-      auto matrev = projmode->rotationMatrix(-att_roll, delpt);
-      matrev.scale(pars.pixsize);
-
-      // find coordinates of detector corners in output image
-      const Point ic1 = mat.apply(Point(0,0) - projorigin) + imgcen;
-      const Point ic2 = mat.apply(Point(CCD_XW,0) - projorigin) + imgcen;
-      const Point ic3 = mat.apply(Point(0,CCD_YW) - projorigin) + imgcen;
-      const Point ic4 = mat.apply(Point(CCD_XW,CCD_YW) - projorigin) + imgcen;
-
-      // calculate integer bounding box of detector in output image
-      const int ic_xlo = int(std::floor(min4(ic1.x, ic2.x, ic3.x, ic4.x)));
-      const int ic_xhi = int(std::ceil (max4(ic1.x, ic2.x, ic3.x, ic4.x)));
-      const int ic_ylo = int(std::floor(min4(ic1.y, ic2.y, ic3.y, ic4.y)));
-      const int ic_yhi = int(std::ceil (max4(ic1.y, ic2.y, ic3.y, ic4.y)));
-
-      // skip if there's no overlap between detector and output image
-      if(! rectoverlap(ic_xlo, ic_xhi, ic_ylo, ic_yhi, -1, pars.xw, -1, pars.yw))
-        continue;
-
-      if( timeseg.idx % 500 == 0 )
-        std::printf("Iteration %5.1f%% (t=%.1f)\n", timeseg.idx*100./num, timeseg.t);
-
-      // detector map for time
-      const Image<float>& dmimg = detmap.getMap(timeseg.t);
-
-      // these are the ranges to iterate over
-      const int minx = std::clamp(ic_xlo-1, 0, int(pars.xw)-1);
-      const int maxx = std::clamp(ic_xhi+1, 0, int(pars.xw)-1);
-      const int miny = std::clamp(ic_ylo-1, 0, int(pars.yw)-1);
-      const int maxy = std::clamp(ic_yhi+1, 0, int(pars.yw)-1);
-
-      // iterate over output image, pixel by pixel
-      float* optr = &imgt.arr[0];
-      for(int i=0; i<miny*int(pars.xw); ++i)
-        *optr++ = 0.f;
-      for(int y=miny; y<=maxy; ++y)
+      for(const TimeSeg& timeseg : batch)
         {
-          for(int x=0; x<minx; ++x)
-            *optr++ = 0.f;
-          for(int x=minx; x<=maxx; ++x)
+          // ccd coordinates of source
+          Point srcccd(timeseg.src_ccdx, timeseg.src_ccdy);
+          Point delpt = srcccd - Point(instpar.x_ref, instpar.y_ref);
+          Point projorigin = projmode.origin(srcccd);
+
+          // matrix to go from detector -> image, including pixel size
+          auto mat = projmode.rotationMatrix(timeseg.roll, delpt);
+          mat.scale(1/pars.pixsize);
+
+          // matrix to go from image -> detector, including pixel size
+          auto matrev = projmode.rotationMatrix(-timeseg.roll, delpt);
+          matrev.scale(pars.pixsize);
+
+          // find coordinates of detector corners in output image
+          const Point ic1 = mat.apply(Point(0,0) - projorigin) + imgcen;
+          const Point ic2 = mat.apply(Point(CCD_XW,0) - projorigin) + imgcen;
+          const Point ic3 = mat.apply(Point(0,CCD_YW) - projorigin) + imgcen;
+          const Point ic4 = mat.apply(Point(CCD_XW,CCD_YW) - projorigin) + imgcen;
+
+          // calculate integer bounding box of detector in output image
+          const int ic_xlo = int(std::floor(min4(ic1.x, ic2.x, ic3.x, ic4.x)));
+          const int ic_xhi = int(std::ceil (max4(ic1.x, ic2.x, ic3.x, ic4.x)));
+          const int ic_ylo = int(std::floor(min4(ic1.y, ic2.y, ic3.y, ic4.y)));
+          const int ic_yhi = int(std::ceil (max4(ic1.y, ic2.y, ic3.y, ic4.y)));
+
+          // skip if there's no overlap between detector and output image
+          if(! rectoverlap(ic_xlo, ic_xhi, ic_ylo, ic_yhi, -2, pars.xw+1, -2, pars.yw+1))
+            continue;
+
+          // detector map for time, and its summed-area table if
+          // averaging over the output pixel footprints
+          const Image<float>& dmimg = detmap.getMap(timeseg.t);
+          const SummedArea* dmsat = footprint ? &detmap.getSummedArea(timeseg.t) : nullptr;
+
+          // these are the ranges to iterate over (footprints reach
+          // further from the detector)
+          const int pad = footprint ? 2 : 1;
+          const int minx = std::clamp(ic_xlo-pad, 0, int(pars.xw)-1);
+          const int maxx = std::clamp(ic_xhi+pad, 0, int(pars.xw)-1);
+          const int miny = std::clamp(ic_ylo-pad, 0, int(pars.yw)-1);
+          const int maxy = std::clamp(ic_yhi+pad, 0, int(pars.yw)-1);
+
+          // spans of output image which are masked
+          auto [att_ra, att_dec, att_roll] = state.att.interpolate(timeseg.t);
+          coordconv.updatePointing(att_ra, att_dec, att_roll);
+          PolyVec maskedpolys(mask.as_ccd_poly(coordconv));
+          applyShiftRotationShift(maskedpolys, mat, projorigin, imgcen);
+          const PolySpans maskspans(maskedpolys, pars.xw, pars.yw);
+
+          // accumulate detector map in unmasked spans covered by the detector
+          const float dt = timeseg.dt;
+          for(int y=miny; y<=maxy; ++y)
             {
+              int xlo, xhi;
+              if(!detectorRowRange(matrev, imgcen, projorigin, y, minx, maxx, footprint, xlo, xhi))
+                continue;
+              subtractSpans(xlo, xhi, maskspans.spans(y), maskspans.numSpans(y), spans);
+
               // rotate around imgcen and move to origin
-              Point det = matrev.apply(Point(x,y)-imgcen) + projorigin;
-
-              // the funny +16. -16 is to ensure correct rounding around zero
-              // without this -0.5 is rounded 0 due to truncation
-              // could use int(std::floor()) instead, but is quite a lot slower
-              int dix = int(det.x+(16.f-0.5f))-16;
-              int diy = int(det.y+(16.f-0.5f))-16;
-
-              if(dix>=0 && diy>=0 && dix<int(CCD_XW) && diy<int(CCD_YW))
-                *optr++ = dmimg(dix, diy);
-              else
-                *optr++ = 0.f;
+              const float py = float(y) - imgcen.y;
+              const ResampleRowPars rowpars{
+                imgcen.x, matrev.m00, matrev.m10,
+                  py*matrev.m01, py*matrev.m11,
+                  projorigin.x, projorigin.y};
+
+              double* outrow = &img.arr[y*int(pars.xw)];
+              for(const Span& span : spans)
+                {
+                  if(dmsat)
+                    footprintRow(*dmsat, &rowvals[0], span.x1, span.x2, y,
+                                 matrev, imgcen, projorigin);
+                  else
+                    resampleRow(&dmimg.arr[0], &rowvals[0], span.x1, span.x2, rowpars);
+                  for(int x=span.x1; x<=span.x2; ++x)
+                    outrow[x] += rowvals[x] * dt;
+                }
             }
-          for(int x=maxx+1; x<int(pars.xw); ++x)
-            *optr++ = 0.f;
-        }
-      for(int i=(maxy+1)*int(pars.xw); i<int(pars.xw*pars.yw); ++i)
-        *optr++ = 0.f;
+        } // segments in batch
+    } // batches
 
-      // zero out polygons with bad regions
-      PolyVec maskedpolys(mask.as_ccd_poly(coordconv));
-      applyShiftRotationShift(maskedpolys, mat, projorigin, imgcen);
-      for(auto& poly: maskedpolys)
-        fillPoly(poly, imgt, 0);
+  // add our part to the total
+  std::lock_guard<std::mutex> lock(mutex);
+  finalimg.arr += img.arr;
+}
 
-      int npix = img.xw * img.yw;
-      for(int i=0; i<npix; ++i)
-        img.arr[i] += imgt.arr[i] * timeseg.dt;
+// project the detector for each time segment, using threads
+static void rasterTimeSegs(TimeSegQueue& queue,
+                           const Pars& pars, const GTITable& gti,
+                           const AttitudeTable& att, const DetMap& detmap,
+                           const Mask& mask, const InstPar& instpar,
+                           const DeadCorTable& deadc,
+                           Image<double>& sumimg)
+{
+  const char* kernelname;
+  selectResampleRow(&kernelname);
+  std::printf("  - using %s resampling kernel\n", kernelname);
 
-    } // input times
+  std::mutex mutex;
 
+  pars.withProjMode([&](const auto& projmode)
+  {
+    using Mode = std::decay_t<decltype(projmode)>;
+    if(pars.threads <= 1)
+      {
+        processGTIs<Mode>(queue, mutex, projmode,
+                          pars, gti, att, detmap,
+                          mask, instpar, deadc, sumimg);
+      }
+    else
+      {
+        std::vector<std::thread> threads;
+        for(unsigned i=0; i != pars.threads; ++i)
+          threads.emplace_back(processGTIs<Mode>,
+                               std::ref(queue), std::ref(mutex), projmode,
+                               pars, gti, att, detmap, mask, instpar, deadc,
+                               std::ref(sumimg));
+        for(auto& thread : threads)
+          thread.join();
+      }
+  });
+}
+
+// project the time segments in the queue, with the method chosen
+static void projectTimeSegs(TimeSegQueue& queue,
+                            const Pars& pars, const GTITable& gti,
+                            const AttitudeTable& att, const DetMap& detmap,
+                            const Mask& mask, const InstPar& instpar,
+                            const DeadCorTable& deadc,
+                            Image<double>& sumimg)
+{
+  if(pars.exposmethod == Pars::EXPOS_AREA)
+    areaTimeSegs(queue, pars, att, detmap, mask, instpar, deadc, sumimg);
+  else if(pars.projmode == Pars::WHOLE_DET)
+    // the detector doesn't move, so the raster method can be skipped
+    exposDetAnalytic(queue, pars, att, detmap, mask, instpar, deadc, sumimg);
+  else
+    rasterTimeSegs(queue, pars, gti, att, detmap, mask, instpar, deadc, sumimg);
 }
 
 static std::vector<TimeSeg> applySampling(const std::vector<TimeSeg>& timesegs, int samples)
@@ -187,108 +298,96 @@ static std::vector<TimeSeg> applySampling(const std::vector<TimeSeg>& timesegs,
         }
 
       // create new segment
-      newsegs.emplace_back( TimeSeg({
-            timesegs[ts].src_ra,
-            timesegs[ts].src_dec,
-            size_t(i),
-            timesegs[ts].t,
-            float(deltat)
-            }) );
+      TimeSeg seg = timesegs[ts];
+      seg.idx = size_t(i);
+      seg.dt = float(deltat);
+      newsegs.push_back(seg);
     }
   return newsegs;
 }
 
-void exposMode(const Pars& pars)
+Image<float> makeExposure(const Pars& pars, const TimeSegPlanner& planner,
+                          const GTITable& gti, AttitudeTable& att,
+                          const DetMap& detmap, const Mask& mask,
+                          const InstPar& instpar, const DeadCorTable& deadc)
 {
-  InstPar instpar = pars.loadInstPar();
-  auto [events, gti, att, detmap, deadc] = pars.loadEventFile();
-
-  Mask mask = pars.loadMask();
-
-  auto projmode = pars.createProjMode();
-  projmode->message();
-  pars.showSources();
-
-  std::printf("Building exposure map\n");
-
-  CoordConv coordconv(instpar);
-
-  // put sources and times in vector
-  std::vector<TimeSeg> timesegs;
-  for(int gtii=0; gtii<int(gti.num); ++gtii)
-    {
-      double tstart = gti.start[gtii];
-      double tstop = gti.stop[gtii];
-
-      if(tstop<=tstart)
-        throw std::runtime_error("invalid GTI found");
-      int numt = int(std::ceil((tstop - tstart) / pars.deltat));
-      double deltat = (tstop - tstart) / numt;
-
-      for(int ti=0; ti<numt; ++ti)
-        {
-          double t = tstart + (ti+0.5)*deltat;
-
-          auto [att_ra, att_dec, att_roll] = att.interpolate(t);
-          coordconv.updatePointing(att_ra, att_dec, att_roll);
-
-          float deadcf = deadc.interpolate(t);
-          for(auto& srcpos : pars.sources)
-            {
-              auto [src_ccdx, src_ccdy] = coordconv.radec2ccd(srcpos[0], srcpos[1]);
-
-              // add time if source is inside region
-              Point srcccd(src_ccdx, src_ccdy);
-              if( projmode->sourceValid(srcccd) )
-                {
-                  timesegs.emplace_back( TimeSeg({
-                        srcpos[0], srcpos[1],
-                        timesegs.size(), t, float(deltat*deadcf)}) );
-                }
-            } // sources
-        } // times in GTI
-    } // GTIs
-
-  // sample if requested, but only if it results in fewer calculations
-  if(pars.samples > 0 && pars.samples < int(timesegs.size()))
-    {
-      timesegs = applySampling(timesegs, pars.samples);
-    }
-
-  // we process them in order of time, so reverse so we pop from back
-  std::reverse(timesegs.begin(), timesegs.end());
-
-  //timesegs.clear();
-  //timesegs.emplace_back(0, 635459963.8, 0.1);
+  if(pars.prefilter && pars.exposmethod == Pars::EXPOS_AREA)
+    throw std::runtime_error("--prefilter cannot be used with the area exposure method");
+  if(pars.prefilter && pars.pixsize > 1)
+    std::printf("  - averaging detector map over output pixels\n");
 
   // summed output image
   Image<double> sumimg(pars.xw, pars.yw, 0.f);
 
-  std::mutex mutex;
-
-  size_t num = timesegs.size();
-  if(pars.threads <= 1)
+  // without masks, the det projection does not need time steps, as
+  // the visible time can be integrated over the bad pixel epochs
+  if(pars.projmode == Pars::WHOLE_DET && pars.exposmethod == Pars::EXPOS_RASTER &&
+     mask.empty())
+    {
+      exposDetIntegrate(pars, planner.visibility(), detmap, deadc, sumimg);
+    }
+  // if the complete list of time steps isn't needed, plan them while
+  // projecting to avoid storing them
+  else if(pars.exposmethod != Pars::EXPOS_CORR && !pars.posebin && pars.samples <= 0)
     {
-      processGTIs(num, timesegs, mutex,
-                  pars, gti, att, detmap,
-                  mask, instpar, sumimg);
+      TimeSegQueue queue(planner);
+      projectTimeSegs(queue, pars, gti, att, detmap, mask, instpar, deadc, sumimg);
     }
   else
     {
-      std::vector<std::thread> threads;
-      for(unsigned i=0; i != pars.threads; ++i)
-        threads.emplace_back(processGTIs,
-                             num, std::ref(timesegs), std::ref(mutex),
-                             pars, gti, att, detmap, mask, instpar,
-                             std::ref(sumimg));
-      for(auto& thread : threads)
-        thread.join();
+      std::vector<TimeSeg> timesegs = planner.planAll(pars, att, deadc);
+
+      // sample if requested, but only if it results in fewer calculations
+      if(pars.samples > 0 && pars.samples < int(timesegs.size()))
+        {
+          timesegs = applySampling(timesegs, pars.samples);
+        }
+
+      // only render each distinct detector pose once
+      if(pars.posebin)
+        {
+          timesegs = binPoses(timesegs, pars, att, detmap, mask, instpar);
+        }
+
+      switch(pars.exposmethod)
+        {
+        case Pars::EXPOS_RASTER:
+        case Pars::EXPOS_AREA:
+          {
+            TimeSegQueue queue(timesegs);
+            projectTimeSegs(queue, pars, gti, att, detmap, mask, instpar, deadc, sumimg);
+          }
+          break;
+        case Pars::EXPOS_CORR:
+          exposCorrelate(pars, timesegs, att, detmap, mask, instpar, sumimg);
+          break;
+        }
     }
 
   Image<float> writeimg(pars.xw, pars.yw);
   for(unsigned y=0; y<pars.yw; ++y)
     for(unsigned x=0; x<pars.xw; ++x)
       writeimg(x,y) = float(sumimg(x,y));
+  return writeimg;
+}
+
+void exposMode(const Pars& pars)
+{
+  InstPar instpar = pars.loadInstPar();
+  // events are not needed for the exposure map
+  auto [events, gti, att, detmap, deadc] = pars.loadEventFile(EventTable::COL_NONE);
+
+  Mask mask = pars.loadMask();
+
+  auto projmode = pars.createProjMode();
+  projmode->message();
+  pars.showSources();
+
+  std::printf("Building exposure map\n");
+
+  TimeSegPlanner planner(pars, att, gti, instpar);
+  Image<float> writeimg = makeExposure(pars, planner, gti, att, detmap, mask,
+                                       instpar, deadc);
 
   Point imgcen = pars.imageCentre();
   std::printf("  - writing output image to %s\n", pars.out_fn.c_str());
@@ -1,8 +1,16 @@
 #ifndef EXPOS_MODE_HH
 #define EXPOS_MODE_HH
 
+#include "expos_plan.hh"
+#include "image.hh"
 #include "pars.hh"
 
+// compute the exposure map for the time segments from the planner
+Image<float> makeExposure(const Pars& pars, const TimeSegPlanner& planner,
+                          const GTITable& gti, AttitudeTable& att,
+                          const DetMap& detmap, const Mask& mask,
+                          const InstPar& instpar, const DeadCorTable& deadc);
+
 void exposMode(const Pars& pars);
 
 #endif
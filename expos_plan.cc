@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "expos_plan.hh"
+#include "common.hh"
+#include "visibility.hh"
+
+// maximum number of time steps in a range of time
+constexpr int MAX_RANGE_STEPS = 4096;
+
+// number of segments in a batch taken from a list
+constexpr size_t LIST_BATCH = 64;
+
+TimeSegPlanner::TimeSegPlanner(const Pars& pars, AttitudeTable& att,
+                               const GTITable& gti, const InstPar& instpar)
+  : deltat(pars.deltat), adaptive_tol(pars.adaptive_tol)
+{
+  auto projmode = pars.createProjMode();
+  vis = buildVisibility(pars, *projmode, att, gti, instpar);
+  tracks = buildTracks(vis, att, instpar);
+  makeRanges(gti);
+}
+
+TimeSegPlanner::TimeSegPlanner(const Pars& pars, const GTITable& gti,
+                               const std::vector<SourceVisibility>& _vis,
+                               const std::vector<SourceTrack>& _tracks)
+  : deltat(pars.deltat), adaptive_tol(pars.adaptive_tol),
+    vis(_vis), tracks(_tracks)
+{
+  makeRanges(gti);
+}
+
+void TimeSegPlanner::makeRanges(const GTITable& gti)
+{
+  for(size_t s=0; s != vis.size(); ++s)
+    {
+      const SourceVisibility& srcvis = vis[s];
+      size_t ivi = 0;
+      for(int gtii=0; gtii<int(gti.num); ++gtii)
+        {
+          double tstart = gti.start[gtii];
+          double tstop = gti.stop[gtii];
+
+          if(tstop<=tstart)
+            throw std::runtime_error("invalid GTI found");
+          int numt = int(std::ceil((tstop - tstart) / deltat));
+          double gtideltat = (tstop - tstart) / numt;
+
+          // iterate over visible intervals inside this GTI
+          for(; ivi < srcvis.start.size() && srcvis.stop[ivi] <= tstop; ++ivi)
+            {
+              const double ta = std::max(srcvis.start[ivi], tstart);
+              const double tb = std::min(srcvis.stop[ivi], tstop);
+
+              // adaptive steps are chosen later, so split by time
+              if(adaptive_tol > 0)
+                {
+                  const double maxlen = MAX_RANGE_STEPS*gtideltat;
+                  for(double t0=ta; t0<tb; t0 += maxlen)
+                    ranges.push_back({s, t0, std::min(t0+maxlen, tb),
+                          tstart, gtideltat, 0, -1});
+                  continue;
+                }
+
+              // steps which have t = tstart + (ti+0.5)*deltat in interval
+              int tilo = std::max(int(std::ceil((ta-tstart)/gtideltat - 0.5)), 0);
+              int tihi = std::min(int(std::floor((tb-tstart)/gtideltat - 0.5)), numt-1);
+
+              // split into ranges with a maximum number of steps
+              for(int ti=tilo; ti<=tihi; ti += MAX_RANGE_STEPS)
+                {
+                  int tie = std::min(ti+MAX_RANGE_STEPS-1, tihi);
+                  ranges.push_back({s,
+                        std::max(ta, tstart + ti*gtideltat),
+                        std::min(tb, tstart + (tie+1)*gtideltat),
+                        tstart, gtideltat, ti, tie});
+                }
+            } // intervals
+        } // GTIs
+    } // sources
+
+  // process in time order
+  std::stable_sort(ranges.begin(), ranges.end(),
+                   [](const Range& a, const Range& b) { return a.ta < b.ta; });
+
+  std::printf("  - split visible time into %ld ranges\n", ranges.size());
+}
+
+void TimeSegPlanner::planRange(size_t idx, PlanState& state,
+                               std::vector<TimeSeg>& segs) const
+{
+  const Range& range = ranges[idx];
+  const SourceVisibility& srcvis = vis[range.src];
+  const SourceTrack& track = tracks[range.src];
+
+  if(adaptive_tol > 0)
+    {
+      addAdaptiveSegs(range, state, segs);
+      return;
+    }
+
+  for(int ti=range.tilo; ti<=range.tihi; ++ti)
+    {
+      double t = range.tstart + (ti+0.5)*range.deltat;
+
+      auto [src_ccdx, src_ccdy, roll] = track.interpolate(t);
+
+      // add time if source is inside region
+      Point srcccd(src_ccdx, src_ccdy);
+      if( state.projmode->sourceValid(srcccd) )
+        {
+          float deadcf = state.deadc.interpolate(t);
+          segs.emplace_back( TimeSeg({
+                srcvis.ra, srcvis.dec,
+                0, t, float(range.deltat*deadcf),
+                srcccd.x, srcccd.y, roll}) );
+        }
+    }
+}
+
+// Add time segments for range, choosing each step so that the
+// detector moves by less than the tolerance relative to the source,
+// measured from the source position and roll at the start, middle and
+// end of the step. Steps are limited to between 1/100 and 1000 times
+// --delta-t.
+void TimeSegPlanner::addAdaptiveSegs(const Range& range, PlanState& state,
+                                     std::vector<TimeSeg>& segs) const
+{
+  const double mindt = deltat * 0.01;
+  const double maxdt = deltat * 1000;
+  const double ta = range.ta;
+  const double tb = range.tb;
+  const SourceVisibility& srcvis = vis[range.src];
+  const SourceTrack& track = tracks[range.src];
+
+  // source position and roll at time
+  struct Pose
+  {
+    double x, y, roll;
+  };
+  auto pose = [&](double t)
+    {
+      auto [src_ccdx, src_ccdy, roll] = track.interpolate(t);
+      return Pose{src_ccdx, src_ccdy, roll};
+    };
+
+  // motion of detector relative to source between poses, where
+  // rolling moves the most distant detector corner most
+  auto motion = [](const Pose& p1, const Pose& p2)
+    {
+      double rmax = 0;
+      for(auto [cx, cy] : {std::pair(0.,0.), std::pair(double(CCD_XW),0.),
+            std::pair(0.,double(CCD_YW)), std::pair(double(CCD_XW),double(CCD_YW))})
+        rmax = std::max(rmax, std::sqrt(sqr(cx-p1.x)+sqr(cy-p1.y)));
+      const double dpos = std::sqrt(sqr(p2.x-p1.x) + sqr(p2.y-p1.y));
+      const double droll = std::abs(std::remainder(p2.roll-p1.roll, 360.));
+      return dpos + droll*DEG2RAD*rmax;
+    };
+
+  double t = ta;
+  double dt = 0.5*deltat;
+  Pose pa = pose(t);
+  while(t < tb)
+    {
+      // try a step twice as long as the last, shortening it until
+      // the motion over the step is within the tolerance
+      dt = std::clamp(2*dt, mindt, maxdt);
+      Pose pmid, pb;
+      for(;;)
+        {
+          dt = std::min(dt, tb-t);
+          pmid = pose(t+0.5*dt);
+          pb = pose(t+dt);
+          const double move = motion(pa, pmid) + motion(pmid, pb);
+          if(move <= adaptive_tol || dt <= mindt)
+            break;
+          dt = std::max(dt*std::max(0.1, 0.9*adaptive_tol/move), mindt);
+        }
+
+      // use centre of step
+      const double tmid = t + 0.5*dt;
+      Point srcccd(pmid.x, pmid.y);
+      if( state.projmode->sourceValid(srcccd) )
+        {
+          float deadcf = state.deadc.interpolate(tmid);
+          segs.emplace_back( TimeSeg({
+                srcvis.ra, srcvis.dec, 0, tmid, float(dt*deadcf),
+                srcccd.x, srcccd.y, pmid.roll}) );
+        }
+
+      t = dt >= tb-t ? tb : t+dt;
+      pa = pb;
+    }
+}
+
+std::vector<TimeSeg> TimeSegPlanner::planAll(const Pars& pars,
+                                             const AttitudeTable& att,
+                                             const DeadCorTable& deadc) const
+{
+  // each thread plans ranges into separate vectors
+  std::vector<std::vector<TimeSeg>> rangesegs(ranges.size());
+  std::atomic<size_t> nextrange(0);
+
+  auto worker = [&]()
+    {
+      PlanState state(pars, att, deadc);
+      for(;;)
+        {
+          size_t idx = nextrange++;
+          if(idx >= ranges.size())
+            break;
+          planRange(idx, state, rangesegs[idx]);
+        }
+    };
+
+  if(pars.threads <= 1)
+    worker();
+  else
+    {
+      std::vector<std::thread> threads;
+      for(unsigned i=0; i != pars.threads; ++i)
+        threads.emplace_back(worker);
+      for(auto& thread : threads)
+        thread.join();
+    }
+
+  size_t tot = 0;
+  for(auto& v : rangesegs)
+    tot += v.size();
+
+  std::vector<TimeSeg> timesegs;
+  timesegs.reserve(tot);
+  for(auto& v : rangesegs)
+    {
+      timesegs.insert(timesegs.end(), v.begin(), v.end());
+      v = std::vector<TimeSeg>();
+    }
+
+  // put in time order (keeping source order for the same time)
+  std::stable_sort(timesegs.begin(), timesegs.end(),
+                   [](const TimeSeg& a, const TimeSeg& b) { return a.t < b.t; });
+  for(size_t i=0; i != timesegs.size(); ++i)
+    timesegs[i].idx = i;
+
+  std::printf("  - planned %ld time steps\n", timesegs.size());
+
+  return timesegs;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+TimeSegQueue::TimeSegQueue(const std::vector<TimeSeg>& _segs)
+  : segs(&_segs), planner(nullptr),
+    cursor(0), total(_segs.size()), lastpct(-1)
+{
+}
+
+TimeSegQueue::TimeSegQueue(const TimeSegPlanner& _planner)
+  : segs(nullptr), planner(&_planner),
+    cursor(0), total(_planner.numRanges()), lastpct(-1)
+{
+}
+
+bool TimeSegQueue::next(std::vector<TimeSeg>& batch, PlanState& state)
+{
+  batch.clear();
+
+  size_t idx, num;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(cursor >= total)
+      return false;
+
+    idx = cursor;
+    num = segs ? std::min(LIST_BATCH, total-cursor) : 1;
+    cursor += num;
+
+    int pct = int(idx*100/total);
+    if(pct != lastpct)
+      {
+        lastpct = pct;
+        std::printf("Iteration %3d%%\n", pct);
+      }
+  }
+
+  if(segs)
+    batch.insert(batch.end(), segs->begin()+idx, segs->begin()+idx+num);
+  else
+    planner->planRange(idx, state, batch);
+
+  // planned ranges can be empty
+  return true;
+}
@@ -0,0 +1,99 @@
+#ifndef EXPOS_PLAN_HH
+#define EXPOS_PLAN_HH
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "pars.hh"
+#include "source_track.hh"
+#include "timeseg.hh"
+
+// per-thread copies of the tables needed to plan time segments
+struct PlanState
+{
+  PlanState(const Pars& pars, const AttitudeTable& _att,
+            const DeadCorTable& _deadc)
+    : att(_att), deadc(_deadc),
+      projmode(pars.createProjMode())
+  {
+  }
+
+  AttitudeTable att;
+  DeadCorTable deadc;
+  std::unique_ptr<ProjMode> projmode;
+};
+
+// Plans the time segments for the exposure map. The visible periods
+// of each source are split into short ranges of time, which can be
+// planned independently and in parallel.
+class TimeSegPlanner
+{
+public:
+  TimeSegPlanner(const Pars& pars, AttitudeTable& att,
+                 const GTITable& gti, const InstPar& instpar);
+
+  // use the visibility and tracks of the sources already found
+  TimeSegPlanner(const Pars& pars, const GTITable& gti,
+                 const std::vector<SourceVisibility>& _vis,
+                 const std::vector<SourceTrack>& _tracks);
+
+  size_t numRanges() const { return ranges.size(); }
+
+  // visible intervals of the sources
+  const std::vector<SourceVisibility>& visibility() const { return vis; }
+
+  // make time segments for the range with index given, appending to segs
+  void planRange(size_t idx, PlanState& state, std::vector<TimeSeg>& segs) const;
+
+  // plan all ranges using threads, returning segments in time order
+  std::vector<TimeSeg> planAll(const Pars& pars, const AttitudeTable& att,
+                               const DeadCorTable& deadc) const;
+
+private:
+  // part of a visible interval during a GTI
+  struct Range
+  {
+    // index of source
+    size_t src;
+    // time range
+    double ta, tb;
+    // fixed steps are t = tstart + (ti+0.5)*deltat, for tilo<=ti<=tihi
+    double tstart, deltat;
+    int tilo, tihi;
+  };
+
+  // split the visible intervals of the sources into ranges
+  void makeRanges(const GTITable& gti);
+
+  void addAdaptiveSegs(const Range& range, PlanState& state,
+                       std::vector<TimeSeg>& segs) const;
+
+private:
+  double deltat, adaptive_tol;
+  std::vector<SourceVisibility> vis;
+  std::vector<SourceTrack> tracks;
+  std::vector<Range> ranges;
+};
+
+// Thread-safe source of batches of time segments to project, either
+// taken from a list of segments, or planned on the fly
+class TimeSegQueue
+{
+public:
+  TimeSegQueue(const std::vector<TimeSeg>& _segs);
+  TimeSegQueue(const TimeSegPlanner& _planner);
+
+  // get next batch of segments into batch (which is cleared first),
+  // returning false if there are none left
+  bool next(std::vector<TimeSeg>& batch, PlanState& state);
+
+private:
+  const std::vector<TimeSeg>* segs;
+  const TimeSegPlanner* planner;
+  std::mutex mutex;
+  size_t cursor, total;
+  int lastpct;
+};
+
+#endif
@@ -9,35 +9,18 @@ static inline bool is_inside(Point p1, Point p2, Point q)
   return R <= 0;
 }
 
+// intersection of line through p1 and p2 with line through p3 and p4
+// (parametric form, which is stable for nearly vertical lines)
 static inline Point compute_intersection(Point p1, Point p2, Point p3, Point p4)
 {
-  float x, y;
-
-  if( std::abs(p2.x-p1.x) < 1e-5f )
-    {
-      x = p1.x;
-      float m2 = (p4.y-p3.y) / (p4.x-p3.x);
-      float b2 = p3.y - m2*p3.x;
-      y = m2*x + b2;
-    }
-  else if( std::abs(p4.x-p3.x) < 1e-5f )
-    {
-      x = p3.x;
-      float m1 = (p2.y-p1.y) / (p2.x-p1.x);
-      float b1 = p1.y - m1*p1.x;
-      y = m1*x + b1;
-    }
-  else
-    {
-      float m1 = (p2.y-p1.y) / (p2.x-p1.x);
-      float b1 = p1.y - m1*p1.x;
-      float m2 = (p4.y-p3.y) / (p4.x-p3.x);
-      float b2 = p3.y - m2*p3.x;
-      x = (b2-b1) / (m1-m2);
-      y = m1*x + b1;
-    }
-
-  return Point(x,y);
+  const Point d1 = p2-p1;
+  const Point d2 = p4-p3;
+  const float denom = d1.x*d2.y - d1.y*d2.x;
+  if(denom == 0)
+    return p2;
+
+  const float t = ((p3.x-p1.x)*d2.y - (p3.y-p1.y)*d2.x) / denom;
+  return p1 + d1*t;
 }
 
 // Sutherland-Hodgman algorithm
@@ -46,13 +29,14 @@ static inline Point compute_intersection(Point p1, Point p2, Point p3, Point p4)
 
 void poly_clip(const Poly& spoly, const Poly& cpoly, Poly& opoly)
 {
+  // reused between calls to avoid allocations
+  static thread_local Poly npoly;
+
   opoly = spoly;
-  Poly npoly;
-  npoly.pts.reserve(std::max(spoly.size(), cpoly.size())*2);
 
-  for(size_t i=0; i != cpoly.size(); ++i)
+  for(size_t i=0; i != cpoly.size() && !opoly.empty(); ++i)
     {
-      npoly = opoly;
+      std::swap(npoly.pts, opoly.pts);
       opoly.clear();
 
       Point cedge1 = cpoly[i==0 ? cpoly.size()-1 : i-1];
@@ -141,29 +125,21 @@ bool Poly::is_inside(Point pt) const
 
   // use ray casting algorithm.
   // odd times horizontal ray crosses poly edge says whether inside
+  // (edges are half open in y, so vertices on the ray count once)
   unsigned count = 0;
   for(size_t i=0; i != num; ++i)
     {
       Point p1 = pts[i];
       Point p2 = pts[(i+1) % num];
 
-      if( pt.y >= std::min(p1.y, p2.y) && pt.y <= std::max(p1.y, p2.y) )
+      if( (p1.y > pt.y) != (p2.y > pt.y) )
         {
-          if( pt.x < std::min(p1.x, p2.x) )
-            // must cross
+          // calculate line x at y=pt.y
+          float grad = (p2.x - p1.x) / (p2.y - p1.y);
+          float lx = p1.x + grad * (pt.y-p1.y);
+          // does +x extending line from pt cross this?
+          if( lx > pt.x )
             ++count;
-          else if( pt.x > std::max(p1.x, p2.x) )
-            // can't cross
-            ;
-          else if( std::abs(p1.y - p2.y) > 1e-6f )
-            {
-              // calculate line x at y=pt.y
-              float grad = (p2.x - p1.x) / (p2.y - p1.y);
-              float lx = p1.x + grad * (pt.y-p1.y);
-              // does +x extending line from pt cross this?
-              if( lx > pt.x )
-                ++count;
-            }
         }
     }
 
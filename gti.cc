@@ -3,6 +3,7 @@
 #include <cstring>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "gti.hh"
@@ -41,6 +42,11 @@ GTITable::GTITable(fitsfile *ff, int tm)
   std::printf("    - successfully read %ld entries\n", nrows);
 }
 
+GTITable::GTITable(std::vector<double> _start, std::vector<double> _stop)
+  : num(_start.size()), start(std::move(_start)), stop(std::move(_stop))
+{
+}
+
 void GTITable::operator&=(const GTITable& o)
 {
   struct timesign
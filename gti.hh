@@ -1,6 +1,7 @@
 #ifndef GTI_HH
 #define GTI_HH
 
+#include <algorithm>
 #include <vector>
 #include <fitsio.h>
 
@@ -8,10 +9,19 @@ class GTITable
 {
 public:
   GTITable(fitsfile *ff, int tm);
+  // make from existing columns
+  GTITable(std::vector<double> _start, std::vector<double> _stop);
 
   // combine joint periods with another table
   void operator&=(const GTITable& o);
 
+  // is time within a GTI? (the GTIs must be in time order)
+  bool contains(double t) const
+  {
+    auto it = std::lower_bound(stop.begin(), stop.end(), t);
+    return it != stop.end() && t >= start[it-stop.begin()];
+  }
+
   size_t num;
   std::vector<double> start, stop;
 };
@@ -51,6 +51,33 @@ static int get_int_bitpix(const Image<int>& img)
 }
 
 
+static void write_extname(fitsfile* ff, const char* extname)
+{
+  if(extname == nullptr)
+    return;
+
+  int status = 0;
+  fits_write_key(ff, TSTRING, "EXTNAME", const_cast<char*>(extname), 0, &status);
+  check_fitsio_status(status);
+}
+
+void write_fits_image(fitsfile* ff, const Image<int>& img,
+                      float xc, float yc, float pixscale,
+                      const char* extname)
+{
+  int status = 0;
+
+  long dims[] = {img.xw, img.yw};
+  long fpixel[] = {1,1};
+  fits_create_img(ff, get_int_bitpix(img), 2, dims, &status);
+  fits_write_pix(ff, TINT, fpixel, img.xw*img.yw,
+                 const_cast<int*>(&img.arr[0]),
+                 &status);
+  check_fitsio_status(status);
+  write_header(ff, xc, yc, pixscale);
+  write_extname(ff, extname);
+}
+
 void write_fits_image(const std::string& filename,
                       const Image<int>& img,
                       float xc, float yc, float pixscale,
@@ -65,14 +92,7 @@ void write_fits_image(const std::string& filename,
   fits_create_file(&ff, filename.c_str(), &status);
   check_fitsio_status(status);
 
-  long dims[] = {img.xw, img.yw};
-  long fpixel[] = {1,1};
-  fits_create_img(ff, get_int_bitpix(img), 2, dims, &status);
-  fits_write_pix(ff, TINT, fpixel, img.xw*img.yw,
-                 const_cast<int*>(&img.arr[0]),
-                 &status);
-  check_fitsio_status(status);
-  write_header(ff, xc, yc, pixscale);
+  write_fits_image(ff, img, xc, yc, pixscale);
 
   fits_close_file(ff, &status);
   check_fitsio_status(status);
@@ -98,21 +118,12 @@ static std::tuple<std::valarray<int>, double> make_int_arr(const std::valarray<f
   return std::make_tuple(intarr, 1/scale);
 }
 
-void write_fits_image(const std::string& filename,
-                      const Image<float>& img,
+void write_fits_image(fitsfile* ff, const Image<float>& img,
                       float xc, float yc, float pixscale,
-                      bool overwrite,
-                      int bitpix)
+                      int bitpix, const char* extname)
 {
-  if(overwrite)
-    std::filesystem::remove(filename);
-
   int status = 0;
 
-  fitsfile* ff;
-  fits_create_file(&ff, filename.c_str(), &status);
-  check_fitsio_status(status);
-
   long dims[] = {img.xw, img.yw};
   long fpixel[] = {1,1};
 
@@ -154,6 +165,25 @@ void write_fits_image(const std::string& filename,
     }
       check_fitsio_status(status);
   write_header(ff, xc, yc, pixscale);
+  write_extname(ff, extname);
+}
+
+void write_fits_image(const std::string& filename,
+                      const Image<float>& img,
+                      float xc, float yc, float pixscale,
+                      bool overwrite,
+                      int bitpix)
+{
+  if(overwrite)
+    std::filesystem::remove(filename);
+
+  int status = 0;
+
+  fitsfile* ff;
+  fits_create_file(&ff, filename.c_str(), &status);
+  check_fitsio_status(status);
+
+  write_fits_image(ff, img, xc, yc, pixscale, bitpix);
 
   fits_close_file(ff, &status);
   check_fitsio_status(status);
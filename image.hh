@@ -7,6 +7,8 @@
 #include <valarray>
 #include <vector>
 
+#include <fitsio.h>
+
 #include "geom.hh"
 
 // thin 2D wrapper to array
@@ -65,6 +67,15 @@ public:
   std::valarray<T> arr;
 };
 
+// write image as a new HDU of an open file, with an optional EXTNAME
+void write_fits_image(fitsfile* ff, const Image<int>& img,
+                      float xc, float yc, float pixscale,
+                      const char* extname=nullptr);
+
+void write_fits_image(fitsfile* ff, const Image<float>& img,
+                      float xc, float yc, float pixscale,
+                      int bitpix=-32, const char* extname=nullptr);
+
 void write_fits_image(const std::string& filename,
                       const Image<int>& img,
                       float xc, float yc, float pixscale,
@@ -116,3 +116,16 @@ InstPar::InstPar(int tm)
   check_fitsio_status(status);
   std::printf("  - done\n");
 }
+
+InstPar::InstPar(double _x_optax, double _y_optax,
+                 double _x_platescale, double _y_platescale,
+                 double _x_ccdpix, double _y_ccdpix,
+                 double _x_ref, double _y_ref)
+  : x_optax(_x_optax), y_optax(_y_optax),
+    x_platescale(_x_platescale), y_platescale(_y_platescale),
+    x_ccdpix(_x_ccdpix), y_ccdpix(_y_ccdpix),
+    x_ref(_x_ref), y_ref(_y_ref),
+    pixscale_x(_x_platescale/3600.), pixscale_y(_y_platescale/3600.),
+    inv_pixscale_x(3600./_x_platescale), inv_pixscale_y(3600./_y_platescale)
+{
+}
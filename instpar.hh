@@ -9,6 +9,11 @@ class InstPar
 {
 public:
   InstPar(int tm);
+  // make from existing values
+  InstPar(double _x_optax, double _y_optax,
+          double _x_platescale, double _y_platescale,
+          double _x_ccdpix, double _y_ccdpix,
+          double _x_ref, double _y_ref);
 
   double x_optax, y_optax;
   double x_platescale, y_platescale;
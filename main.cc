@@ -14,11 +14,22 @@
 #include "image_mode.hh"
 #include "expos_mode.hh"
 #include "event_mode.hh"
+#include "multi_mode.hh"
+#include "cache_mode.hh"
 
 int main(int argc, char** argv)
 {
   // whether to run in imaging or exposure mode
   std::map<std::string, Pars::runmodetype> modemap{
+    {"image", Pars::IMAGE},
+    {"expos", Pars::EXPOS},
+    {"event", Pars::EVENT},
+    {"multi", Pars::MULTI},
+    {"cache", Pars::CACHE}
+  };
+
+  // products which can be made in multi mode
+  std::map<std::string, Pars::runmodetype> productmap{
     {"image", Pars::IMAGE},
     {"expos", Pars::EXPOS},
     {"event", Pars::EVENT}
@@ -35,13 +46,22 @@ int main(int argc, char** argv)
     {"box", Pars::BOX},
   };
 
+  // exposure map methods
+  std::map<std::string, Pars::exposmethodtype> exposmethodmap{
+    {"raster", Pars::EXPOS_RASTER},
+    {"corr", Pars::EXPOS_CORR},
+    {"area", Pars::EXPOS_AREA},
+  };
+
   CLI::App app{"Make eROSITA unvignetted detector exposure maps and images"};
   argv = app.ensure_utf8(argv);
 
   Pars pars;
 
   app.add_option("--sources", pars.sources, "List of RA,Dec for sources")
-    ->delimiter(',')->expected(1,10000000)->required();
+    ->delimiter(',')->expected(1,10000000);
+  app.add_option("--catalog", pars.catalog_fn, "Catalog of sources (FITS with RA,DEC columns or text with ra,dec lines)")
+    ->check(CLI::ExistingFile);
   app.add_option("--proj", pars.projmode, "Projection mode")
     ->transform(CLI::CheckedTransformer(projmodemap, CLI::ignore_case))
     ->capture_default_str();
@@ -72,8 +92,33 @@ int main(int argc, char** argv)
     ->capture_default_str();
   app.add_option("--delta-t", pars.deltat, "Time step (s)")
     ->capture_default_str();
+  app.add_option("--adaptive-tol", pars.adaptive_tol, "Adaptive time steps with this maximum motion (det pixels, 0 to disable)")
+    ->capture_default_str();
   app.add_option("--samples", pars.samples, "Activate sampling for exposure map with number of samples given")
     ->capture_default_str();
+  app.add_option("--vis-stride", pars.vis_stride, "Time stride for finding source visibility (s, 0 to disable)")
+    ->capture_default_str();
+  app.add_option("--expos-method", pars.exposmethod, "Exposure map method")
+    ->transform(CLI::CheckedTransformer(exposmethodmap, CLI::ignore_case))
+    ->capture_default_str();
+  app.add_flag("--pose-bin", pars.posebin, "Render each distinct detector pose once in exposure map");
+  app.add_option("--pose-tol-pix", pars.pose_tol_pix, "Pose binning position tolerance (output pixels)")
+    ->capture_default_str();
+  app.add_option("--pose-tol-deg", pars.pose_tol_deg, "Pose binning roll tolerance (deg)")
+    ->capture_default_str();
+  app.add_flag("--prefilter", pars.prefilter, "Average detector map over output pixel size in exposure map");
+  app.add_option("--event-group-dt", pars.event_group_dt, "Use same pointing for events within this time (s, image/event mode)")
+    ->capture_default_str();
+  app.add_flag("--compact-events", pars.compact_events, "Store events in a compact layout to save memory (image/event mode)");
+  app.add_flag("--ordered-events", pars.ordered_events, "Write output events in time order (event mode)");
+  app.add_option("--products", pars.products, "Products to make in multi mode")
+    ->delimiter(',')
+    ->transform(CLI::CheckedTransformer(productmap, CLI::ignore_case));
+  app.add_option("--image-out", pars.image_out_fn, "Separate image output filename (multi mode)");
+  app.add_option("--expos-out", pars.expos_out_fn, "Separate exposure map output filename (multi mode)");
+  app.add_option("--event-out", pars.event_out_fn, "Separate event output filename (multi mode)");
+  app.add_option("--cache-dir", pars.cache_dir, "Directory for caching tables loaded from event files");
+  app.add_flag("--cache-prune", pars.cache_prune, "Remove cache entries for changed or removed event files (cache mode)");
   app.add_option("--threads", pars.threads, "Number of threads")
     ->capture_default_str();
   app.add_option("--bitpix", pars.bitpix, "How many bitpix to use for output exposure maps")
@@ -85,8 +130,7 @@ int main(int argc, char** argv)
   app.add_option("event", pars.evt_fn, "Event filename")
     ->required()
     ->check(CLI::ExistingFile);
-  app.add_option("image", pars.out_fn, "Output image filename")
-    ->required();
+  app.add_option("image", pars.out_fn, "Output image filename (not used in cache mode)");
 
   std::string config_file;
   app.set_config("--config", config_file, "Read options from a config file", false);
@@ -95,6 +139,15 @@ int main(int argc, char** argv)
 
   try
     {
+      if(pars.mode != Pars::CACHE)
+        {
+          if(pars.out_fn.empty())
+            throw std::runtime_error("No output filename given");
+          pars.loadCatalog();
+          if(pars.sources.empty())
+            throw std::runtime_error("No sources given (use --sources or --catalog)");
+        }
+
       switch(pars.mode)
         {
         case Pars::IMAGE:
@@ -106,6 +159,12 @@ int main(int argc, char** argv)
         case Pars::EVENT:
           eventMode(pars);
           break;
+        case Pars::MULTI:
+          multiMode(pars);
+          break;
+        case Pars::CACHE:
+          cacheMode(pars);
+          break;
         }
     }
   catch(std::runtime_error& e)
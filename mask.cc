@@ -2,7 +2,9 @@
 // yuck
 #undef PI
 
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <stdexcept>
@@ -13,90 +15,199 @@
 #include "common.hh"
 #include "mask.hh"
 
-namespace
+WCS::WCS(fitsfile *ff)
+  : copied(false)
 {
+  int status = 0;
+  int nkeyrec;
+  char* hdrstr;
+  fits_hdr2str(ff, 0, NULL, 0, &hdrstr, &nkeyrec, &status);
+  check_fitsio_status(status);
+
+  int nreject;
+  status = wcspih(hdrstr, nkeyrec, WCSHDR_all, 2, &nreject, &nwcs, &wcs);
+  std::free(hdrstr);
 
-  // little WCS wrapper
-  class WCS
-  {
-  public:
-    WCS(fitsfile *ff);
-    ~WCS();
-    CoordVec pix2sky(const CoordVec& pvec);
-
-  private:
-    int nwcs;
-    struct wcsprm *wcs;
-  };
-
-  WCS::WCS(fitsfile *ff)
-  {
-    int status = 0;
-    int nkeyrec;
-    char* hdrstr;
-    fits_hdr2str(ff, 0, NULL, 0, &hdrstr, &nkeyrec, &status);
-    check_fitsio_status(status);
-
-    int nreject;
-    status = wcspih(hdrstr, nkeyrec, WCSHDR_all, 2, &nreject, &nwcs, &wcs);
-    std::free(hdrstr);
-
-    if(status != 0)
-      {
-        std::string err = std::string("WCS wcspih ERROR ") +
-          std::to_string(status) + ": " + wcshdr_errmsg[status];
-        throw std::runtime_error(err);
-      }
+  if(status != 0)
+    {
+      std::string err = std::string("WCS wcspih ERROR ") +
+        std::to_string(status) + ": " + wcshdr_errmsg[status];
+      throw std::runtime_error(err);
+    }
+
+  status = wcsset(wcs);
+  if (status != 0)
+    {
+      std::string err = std::string("WCS wcsset ERROR ") +
+        std::to_string(status) + ": " + wcshdr_errmsg[status];
+      throw std::runtime_error(err);
+    }
+}
 
+WCS::WCS(const WCS& other)
+  : nwcs(0), wcs(nullptr), copied(false)
+{
+  *this = other;
+}
+
+WCS& WCS::operator=(const WCS& other)
+{
+  if(this == &other)
+    return *this;
+
+  release();
+  if(other.wcs == nullptr)
+    return *this;
+
+  // wcslib structs need a deep copy, so each thread can have its own
+  wcs = static_cast<struct wcsprm*>(std::calloc(1, sizeof(struct wcsprm)));
+  wcs->flag = -1;
+  copied = true;
+
+  int status = wcssub(1, other.wcs, 0x0, 0x0, wcs);
+  if(status == 0)
     status = wcsset(wcs);
-    if (status != 0)
-      {
-        std::string err = std::string("WCS wcsset ERROR ") +
-          std::to_string(status) + ": " + wcshdr_errmsg[status];
-        throw std::runtime_error(err);
-      }
-  }
-
-  CoordVec WCS::pix2sky(const CoordVec& pixcrd)
-  {
-    int ncoord = pixcrd.size();
-    if(ncoord<=0)
-      return CoordVec();
-
-    CoordVec world, imgcrd;
-    world.resize(ncoord);
-    imgcrd.resize(ncoord);
-
-    std::vector<double> phi, theta;
-    phi.resize(ncoord);
-    theta.resize(ncoord);
-    std::vector<int> stat;
-    stat.resize(ncoord);
-
-    int status = wcsp2s(wcs, ncoord, 2, &pixcrd[0].lon, &imgcrd[0].lon,
-                        &phi[0], &theta[0], &world[0].lon, &stat[0]);
-    if( status != 0 )
-      {
-        std::string err = std::string("WCS wcsp2s ERROR ") +
-          std::to_string(status) + ": " + wcshdr_errmsg[status];
-        throw std::runtime_error(err);
-      }
-
-    return world;
-  }
-
-  WCS::~WCS()
-  {
+  if(status != 0)
+    {
+      std::string err = std::string("WCS copy ERROR ") +
+        std::to_string(status) + ": " + wcs_errmsg[status];
+      throw std::runtime_error(err);
+    }
+
+  return *this;
+}
+
+CoordVec WCS::pix2sky(const CoordVec& pixcrd)
+{
+  int ncoord = pixcrd.size();
+  if(ncoord<=0)
+    return CoordVec();
+
+  CoordVec world, imgcrd;
+  world.resize(ncoord);
+  imgcrd.resize(ncoord);
+
+  std::vector<double> phi, theta;
+  phi.resize(ncoord);
+  theta.resize(ncoord);
+  std::vector<int> stat;
+  stat.resize(ncoord);
+
+  int status = wcsp2s(wcs, ncoord, 2, &pixcrd[0].lon, &imgcrd[0].lon,
+                      &phi[0], &theta[0], &world[0].lon, &stat[0]);
+  if( status != 0 )
+    {
+      std::string err = std::string("WCS wcsp2s ERROR ") +
+        std::to_string(status) + ": " + wcshdr_errmsg[status];
+      throw std::runtime_error(err);
+    }
+
+  return world;
+}
+
+void WCS::sky2pix(size_t n, const double* lon, const double* lat,
+                  double* x, double* y, uint8_t* valid) const
+{
+  if(n == 0)
+    return;
+
+  static thread_local std::vector<double> world, imgcrd, pixcrd, phi, theta;
+  static thread_local std::vector<int> stat;
+  world.resize(n*2);
+  imgcrd.resize(n*2);
+  pixcrd.resize(n*2);
+  phi.resize(n);
+  theta.resize(n);
+  stat.assign(n, 0);
+
+  for(size_t i=0; i != n; ++i)
+    {
+      world[i*2] = lon[i];
+      world[i*2+1] = lat[i];
+    }
+
+  // status 9 means that some coordinates were invalid, given in stat
+  int status = wcss2p(wcs, int(n), 2, &world[0], &phi[0], &theta[0],
+                      &imgcrd[0], &pixcrd[0], &stat[0]);
+  const bool ok = status == 0 || status == 9;
+
+  for(size_t i=0; i != n; ++i)
+    {
+      x[i] = pixcrd[i*2];
+      y[i] = pixcrd[i*2+1];
+      valid[i] = ok && stat[i] == 0;
+    }
+}
+
+void WCS::release()
+{
+  if(wcs == nullptr)
+    return;
+
+  if(copied)
+    {
+      wcsfree(wcs);
+      std::free(wcs);
+    }
+  else
     wcsvfree(&nwcs, &wcs);
-  }
 
-} // namespace
+  wcs = nullptr;
+  nwcs = 0;
+  copied = false;
+}
+
+WCS::~WCS()
+{
+  release();
+}
+
+// replace pairs of points in polygons by their mean
+static void simplify_polys(PolyVec& polys)
+{
+  for(auto& poly : polys)
+    {
+      if(poly.size() < 6)
+        continue;
+
+      Poly out;
+      for(size_t i=0; i < poly.size(); i+=2)
+        {
+          Point p1 = poly[i];
+          if(i == poly.size()-1)
+            out.add(p1);
+          else
+            out.add((p1+poly[i+1])*0.5f);
+        }
+      poly = out;
+    }
+}
+
+// number of points in "circular" polygons for mask points
+constexpr int MASK_PT_NPTS = 32;
+
+// polygon approximating a mask point circle, used both for the
+// exposure and for testing events
+static Poly mask_pt_poly(double ccdx, double ccdy, double rad)
+{
+  Poly poly;
+  poly.pts.reserve(MASK_PT_NPTS);
+  for(int i=0; i<MASK_PT_NPTS; ++i)
+    {
+      double theta = (2*PI/MASK_PT_NPTS) * (i+0.11);
+      poly.add(Point(ccdx + rad*std::cos(theta),
+                     ccdy + rad*std::sin(theta)));
+    }
+  return poly;
+}
 
 Mask::Mask()
+  : bits_xw(0), bits_yw(0)
 {
 }
 
 Mask::Mask(const std::string& filename, bool simplify)
+  : bits_xw(0), bits_yw(0)
 {
   if(filename.empty())
     {
@@ -135,9 +246,32 @@ Mask::Mask(const std::string& filename, bool simplify)
   fits_close_file(ff, &status);
   check_fitsio_status(status);
 
+  // keep bitmap of masked pixels for looking up events
+  bits_xw = axes[0];
+  bits_yw = axes[1];
+  maskbits.assign((bits_xw*bits_yw+63)/64, 0);
+  for(long i=0; i<bits_xw*bits_yw; ++i)
+    if(maskimg.arr[i] <= 0)
+      maskbits[i>>6] |= uint64_t(1) << (i&63);
+  maskwcs = wcs;
+
   PolyVec polys = mask_to_polygons(maskimg, true, !simplify);
   std::printf("  - found %ld polygons\n", polys.size());
 
+  if(simplify)
+    {
+      // simplify in mask pixel coordinates, keeping the polygons to
+      // look up events, so they are masked by the same region as the
+      // exposure
+      simplify_polys(polys);
+      pixpolys = polys;
+
+      size_t npts = 0;
+      for(auto& poly : polys)
+        npts += poly.size();
+      std::printf("  - simplified to %ld coordinates\n", npts);
+    }
+
   size_t ct = 0;
   for(auto &poly : polys)
     {
@@ -155,19 +289,6 @@ Mask::Mask(const std::string& filename, bool simplify)
     }
 
   std::printf("  - converted to %ld sky coordinates\n", ct);
-
-
-  if(simplify)
-    {
-      simplifyPolys();
-
-      ct = 0;
-      for(auto &coords : maskcoords)
-        ct += coords.size();
-
-      std::printf("  - simplified to %ld coordinates\n", ct);
-    }
-
 }
 
 void Mask::setMaskPts(const std::vector<std::array<double,3>>& pts)
@@ -180,29 +301,6 @@ void Mask::setMaskPts(const std::vector<std::array<double,3>>& pts)
     }
 }
 
-void Mask::simplifyPolys()
-{
-  for(auto& cv : maskcoords)
-    {
-      if(cv.size() < 6)
-        continue;
-
-      CoordVec out;
-      for(size_t i=0; i < cv.size(); i+=2)
-        {
-          Coord c1 = cv[i];
-          if(i == cv.size()-1)
-            out.push_back(c1);
-          else
-            {
-              Coord c2 = cv[i+1];
-              out.emplace_back(0.5*(c1.lon+c2.lon), 0.5*(c1.lat+c2.lat));
-            }
-        }
-      cv = out;
-    }
-}
-
 void Mask::writeRegion(const std::string& filename) const
 {
   // no error checking! debugging only
@@ -244,22 +342,138 @@ PolyVec Mask::as_ccd_poly(const CoordConv& cc) const
 
   for(auto& mpt : mask_pts)
     {
-      double ra = mpt[0];
-      double dec = mpt[1];
-      double rad = mpt[2];
+      auto [ccdx, ccdy] = cc.radec2ccd(mpt[0], mpt[1]);
+      polys.push_back(mask_pt_poly(ccdx, ccdy, mpt[2]));
+    }
 
-      const int npts = 32; // number of points in "circular" polygon
-      auto [ccdx, ccdy] = cc.radec2ccd(ra, dec);
-      polys.emplace_back();
-      Poly& poly = polys.back();
-      poly.pts.reserve(npts);
-      for(int i=0; i<npts; ++i)
+  return polys;
+}
+
+void Mask::updatePointing(const CoordConv& cc)
+{
+  mask_pts_ccd.clear();
+  mask_pts_poly.clear();
+  for(auto& mpt : mask_pts)
+    {
+      auto [ccdx, ccdy] = cc.radec2ccd(mpt[0], mpt[1]);
+      mask_pts_ccd.emplace_back(ccdx, ccdy);
+      mask_pts_poly.push_back(mask_pt_poly(ccdx, ccdy, mpt[2]));
+    }
+}
+
+void Mask::flagSkyMasked(size_t n, const double* ra, const double* dec,
+                         uint8_t* flags) const
+{
+  std::fill(flags, flags+n, 0);
+  if(!maskwcs.valid())
+    return;
+
+  static thread_local std::vector<double> px, py;
+  static thread_local std::vector<uint8_t> valid;
+  px.resize(n);
+  py.resize(n);
+  valid.resize(n);
+  maskwcs.sky2pix(n, ra, dec, &px[0], &py[0], &valid[0]);
+
+  for(size_t i=0; i != n; ++i)
+    {
+      // pixel i covers FITS coordinates i+0.5 to i+1.5
+      const long ix = long(std::floor(px[i]-0.5));
+      const long iy = long(std::floor(py[i]-0.5));
+      if(!valid[i] || ix<0 || iy<0 || ix>=bits_xw || iy>=bits_yw)
+        continue;
+
+      if(!pixpolys.empty())
+        {
+          // simplified polygons no longer follow the pixel edges
+          flags[i] = is_inside(pixpolys, Point(px[i]-0.5, py[i]-0.5));
+        }
+      else
         {
-          double theta = (2*PI/npts) * (i+0.11);
-          poly.add(Point(ccdx + rad*std::cos(theta),
-                         ccdy + rad*std::sin(theta)));
+          const long bit = iy*bits_xw+ix;
+          flags[i] = (maskbits[bit>>6] >> (bit&63)) & 1;
         }
     }
+}
 
-  return polys;
+void Mask::flagPointMasked(size_t n, const float* ccdx, const float* ccdy,
+                           uint8_t* flags) const
+{
+  // events are tested against the same polygons subtracted from the
+  // exposure, which lie between the inscribed circle and the circle
+  const double cosedge = std::cos(PI/MASK_PT_NPTS);
+
+  for(size_t k=0; k != mask_pts_ccd.size(); ++k)
+    {
+      const Point pt = mask_pts_ccd[k];
+      const Poly& poly = mask_pts_poly[k];
+      const double rad2 = sqr(mask_pts[k][2]);
+      const double inrad2 = sqr(mask_pts[k][2]*cosedge);
+      for(size_t i=0; i != n; ++i)
+        {
+          const double dx = ccdx[i] - pt.x;
+          const double dy = ccdy[i] - pt.y;
+          const double r2 = dx*dx + dy*dy;
+          if(r2 < inrad2)
+            flags[i] = 1;
+          else if(r2 < rad2)
+            {
+              // anticlockwise convex polygon: inside if left of all edges
+              bool inside = true;
+              for(size_t j=0; j != poly.size() && inside; ++j)
+                {
+                  const Point p1 = poly[j];
+                  const Point p2 = poly[(j+1) % poly.size()];
+                  inside = (double(p2.x)-p1.x)*(ccdy[i]-double(p1.y)) -
+                    (double(p2.y)-p1.y)*(ccdx[i]-double(p1.x)) > 0;
+                }
+              flags[i] |= inside;
+            }
+        }
+    }
+}
+
+std::vector<SkyCircle> Mask::boundingCircles(double pixscale) const
+{
+  std::vector<SkyCircle> circles;
+
+  for(auto& cv : maskcoords)
+    {
+      // use mean of unit vectors as centre to avoid problems at ra=0
+      double sx=0, sy=0, sz=0;
+      for(auto& coord : cv)
+        {
+          double cosdec = std::cos(coord.lat*DEG2RAD);
+          sx += cosdec*std::cos(coord.lon*DEG2RAD);
+          sy += cosdec*std::sin(coord.lon*DEG2RAD);
+          sz += std::sin(coord.lat*DEG2RAD);
+        }
+      double norm = std::sqrt(sx*sx+sy*sy+sz*sz);
+      if(norm == 0)
+        norm = 1;
+      sx /= norm; sy /= norm; sz /= norm;
+
+      // radius is largest separation of vertex from centre
+      double mindot = 1;
+      for(auto& coord : cv)
+        {
+          double cosdec = std::cos(coord.lat*DEG2RAD);
+          double dot = sx*cosdec*std::cos(coord.lon*DEG2RAD) +
+            sy*cosdec*std::sin(coord.lon*DEG2RAD) +
+            sz*std::sin(coord.lat*DEG2RAD);
+          mindot = std::min(mindot, dot);
+        }
+
+      double ra = std::atan2(sy, sx)*RAD2DEG;
+      if(ra < 0)
+        ra += 360;
+      double dec = std::asin(std::clamp(sz, -1., 1.))*RAD2DEG;
+      double rad = std::acos(std::clamp(mindot, -1., 1.))*RAD2DEG;
+      circles.push_back({ra, dec, rad});
+    }
+
+  for(auto& mpt : mask_pts)
+    circles.push_back({mpt[0], mpt[1], mpt[2]*pixscale});
+
+  return circles;
 }
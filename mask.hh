@@ -1,9 +1,13 @@
 #ifndef MASK_HH
 #define MASK_HH
 
+#include <array>
+#include <cstdint>
 #include <string>
 #include <vector>
 
+#include <fitsio.h>
+
 #include "coords.hh"
 #include "geom.hh"
 
@@ -17,20 +21,88 @@ struct Coord
 typedef std::vector<Coord> CoordVec;
 typedef std::vector<CoordVec> CoordVecVec;
 
+// circle on the sky enclosing a masked region (degrees)
+struct SkyCircle
+{
+  double ra, dec, rad;
+};
+
+struct wcsprm;
+
+// little WCS wrapper
+class WCS
+{
+public:
+  WCS() : nwcs(0), wcs(nullptr), copied(false) {}
+  WCS(fitsfile *ff);
+  WCS(const WCS& other);
+  WCS& operator=(const WCS& other);
+  ~WCS();
+
+  bool valid() const { return wcs != nullptr; }
+  CoordVec pix2sky(const CoordVec& pvec);
+
+  // convert n sky coordinates to pixel coordinates, setting
+  // valid[i] to whether each conversion was possible
+  void sky2pix(size_t n, const double* lon, const double* lat,
+               double* x, double* y, uint8_t* valid) const;
+
+private:
+  void release();
+
+private:
+  int nwcs;
+  struct wcsprm *wcs;
+  // whether wcs was allocated by copying
+  bool copied;
+};
+
 class Mask
 {
 public:
   Mask();
   Mask(const std::string& filename, bool simplify=false);
   void setMaskPts(const std::vector<std::array<double,3>>& pts);
-  void simplifyPolys();
   void writeRegion(const std::string& filename) const;
 
   PolyVec as_ccd_poly(const CoordConv& cc) const;
 
+  // compute detector coordinates of mask points for flagPointMasked
+  void updatePointing(const CoordConv& cc);
+
+  // Set flags[i] for each of n events to whether its sky position is
+  // masked in the mask image
+  void flagSkyMasked(size_t n, const double* ra, const double* dec,
+                     uint8_t* flags) const;
+
+  // Set flags[i] for events with detector coordinates inside the
+  // polygon for a mask point (at the pointing given to updatePointing). Other flags are
+  // left unchanged.
+  void flagPointMasked(size_t n, const float* ccdx, const float* ccdy,
+                       uint8_t* flags) const;
+
+  // are there no masked regions?
+  bool empty() const { return maskcoords.empty() && mask_pts.empty(); }
+
+  // get circles enclosing each masked region, in the same order as
+  // the polygons from as_ccd_poly
+  // pixscale: size of detector pixel in degrees
+  std::vector<SkyCircle> boundingCircles(double pixscale) const;
+
 private:
   CoordVecVec maskcoords;
   std::vector<std::array<double,3>> mask_pts;
+  // detector coordinates of mask_pts and their polygons
+  std::vector<Point> mask_pts_ccd;
+  std::vector<Poly> mask_pts_poly;
+
+  // masked pixels in mask image, as bits, with its WCS
+  std::vector<uint64_t> maskbits;
+  long bits_xw, bits_yw;
+  WCS maskwcs;
+  // simplified polygons in mask pixel coordinates, used instead of
+  // the bitmap if set
+  PolyVec pixpolys;
   float src_rad;
 };
 
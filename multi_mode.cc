@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fitsio.h>
+
+#include "multi_mode.hh"
+#include "common.hh"
+#include "event_proj.hh"
+#include "event_writer.hh"
+#include "expos_mode.hh"
+#include "expos_plan.hh"
+#include "image.hh"
+#include "source_track.hh"
+#include "visibility.hh"
+
+// make several of the image, exposure map and event list products
+// together, sharing the input tables, source visibility and tracks
+
+namespace
+{
+  // fits files to write products into, opened when first needed
+  class OutFiles
+  {
+  public:
+    ~OutFiles()
+    {
+      int status = 0;
+      for(auto& [fn, ff] : files)
+        fits_close_file(ff, &status);
+    }
+
+    fitsfile* get(const std::string& fn)
+    {
+      for(auto& [ofn, ff] : files)
+        if(ofn == fn)
+          return ff;
+
+      std::filesystem::remove(fn);
+      int status = 0;
+      fitsfile* ff;
+      fits_create_file(&ff, fn.c_str(), &status);
+      check_fitsio_status(status);
+      files.emplace_back(fn, ff);
+      return ff;
+    }
+
+    void close()
+    {
+      int status = 0;
+      for(auto& [fn, ff] : files)
+        fits_close_file(ff, &status);
+      files.clear();
+      check_fitsio_status(status);
+    }
+
+  private:
+    std::vector<std::pair<std::string,fitsfile*>> files;
+  };
+}
+
+void multiMode(const Pars& pars)
+{
+  auto want = [&pars](Pars::runmodetype prod)
+  {
+    return std::find(pars.products.begin(), pars.products.end(), prod) !=
+      pars.products.end();
+  };
+  const bool doimage = want(Pars::IMAGE);
+  const bool doexpos = want(Pars::EXPOS);
+  const bool doevent = want(Pars::EVENT);
+
+  InstPar instpar = pars.loadInstPar();
+  unsigned evtcols = EventTable::COL_NONE;
+  if(doimage || doevent)
+    evtcols |= EventTable::COL_RAW | EventTable::COL_CCD | EventTable::COL_RADEC;
+  if(doevent)
+    evtcols |= EventTable::COL_PI;
+  auto [events, gti, att, detmap, deadc] = pars.loadEventFile(evtcols);
+  if(doimage || doevent)
+    events.filter_badpix(detmap);
+  Mask mask = pars.loadMask();
+
+  pars.createProjMode()->message();
+  pars.showSources();
+
+  // visibility and track of each source, used for all the products
+  std::vector<SourceVisibility> vis;
+  std::vector<SourceTrack> tracks;
+  {
+    auto projmode = pars.createProjMode();
+    vis = buildVisibility(pars, *projmode, att, gti, instpar);
+    tracks = buildTracks(vis, att, instpar);
+  }
+
+  // products without their own file are written as HDUs of out_fn
+  auto outfn = [&pars](const std::string& fn)
+  {
+    return fn.empty() ? pars.out_fn : fn;
+  };
+  OutFiles files;
+
+  // project the events once for the image and event list, writing
+  // the events as they are made
+  Image<int> cntimg(doimage ? pars.xw : 0, doimage ? pars.yw : 0, 0);
+  if(doimage || doevent)
+    {
+      std::printf("Building %s\n",
+                  doimage && doevent ? "image and event list" :
+                  doimage ? "image" : "event list");
+
+      std::unique_ptr<EventWriter> writer;
+      if(doevent)
+        {
+          std::printf("  - writing output events to %s\n", outfn(pars.event_out_fn).c_str());
+          writer = std::make_unique<EventWriter>(files.get(outfn(pars.event_out_fn)),
+                                                 pars.ordered_events);
+        }
+
+      projectEvents(pars, events, vis, tracks, gti, att, mask, instpar,
+                    doimage ? &cntimg : nullptr, writer.get());
+
+      if(writer)
+        {
+          size_t nrows = writer->finish();
+          std::printf("    - written %ld events\n", nrows);
+        }
+    }
+
+  Image<float> exposimg(0, 0);
+  if(doexpos)
+    {
+      std::printf("Building exposure map\n");
+      TimeSegPlanner planner(pars, gti, vis, tracks);
+      exposimg = makeExposure(pars, planner, gti, att, detmap, mask,
+                              instpar, deadc);
+    }
+
+  Point imgcen = pars.imageCentre();
+  if(doimage)
+    {
+      std::printf("  - writing output image to %s\n", outfn(pars.image_out_fn).c_str());
+      write_fits_image(files.get(outfn(pars.image_out_fn)), cntimg,
+                       imgcen.x, imgcen.y, pars.pixsize, "IMAGE");
+    }
+  if(doexpos)
+    {
+      std::printf("  - writing output exposure map to %s\n", outfn(pars.expos_out_fn).c_str());
+      write_fits_image(files.get(outfn(pars.expos_out_fn)), exposimg,
+                       imgcen.x, imgcen.y, pars.pixsize, pars.bitpix, "EXPOSURE");
+    }
+  files.close();
+}
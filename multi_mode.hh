@@ -0,0 +1,8 @@
+#ifndef MULTI_MODE_HH
+#define MULTI_MODE_HH
+
+#include "pars.hh"
+
+void multiMode(const Pars& pars);
+
+#endif
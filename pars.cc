@@ -1,14 +1,24 @@
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
 
 #include <fitsio.h>
 
 #include "common.hh"
 #include "pars.hh"
+#include "event_cache.hh"
 
 Pars::Pars()
 : mode(IMAGE),
+  products{IMAGE, EXPOS, EVENT},
   tm(1),
+  num_catalog(0),
   pimin(300), pimax(2300),
   projmode(AVERAGE_FOV),
   detmapmask(false),
@@ -18,12 +28,50 @@ Pars::Pars()
   pixsize(1),
   bitpix(-32),
   deltat(0.01),
-  samples(-1)
+  adaptive_tol(0),
+  samples(-1),
+  vis_stride(0),
+  exposmethod(EXPOS_RASTER),
+  posebin(false),
+  pose_tol_pix(0.1f), pose_tol_deg(0.05f),
+  prefilter(false),
+  event_group_dt(0),
+  compact_events(false),
+  ordered_events(false),
+  cache_prune(false)
 {
 }
 
 std::tuple<EventTable,GTITable,AttitudeTable,DetMap,DeadCorTable>
-Pars::loadEventFile() const
+Pars::loadEventFile(unsigned evtcols) const
+{
+  // sky positions are only needed to look up events in a mask image
+  if(mask_fn.empty())
+    evtcols &= ~unsigned(EventTable::COL_RADEC);
+
+  if(cache_dir.empty())
+    return readEventFile(evtcols, compact_events);
+  if(!canCache(*this))
+    {
+      std::printf("Not using cache, as the input files are not all local files\n");
+      return readEventFile(evtcols, compact_events);
+    }
+
+  // make cache entry with all the columns if it does not exist
+  const std::string cachefn = cacheFilename(*this);
+  if(!std::filesystem::exists(cachefn))
+    {
+      auto tables = readEventFile(EventTable::COL_RAW | EventTable::COL_CCD |
+                                  EventTable::COL_RADEC | EventTable::COL_PI,
+                                  false);
+      writeCache(cachefn, *this, tables);
+    }
+
+  return readCache(cachefn, *this, evtcols);
+}
+
+std::tuple<EventTable,GTITable,AttitudeTable,DetMap,DeadCorTable>
+Pars::readEventFile(unsigned evtcols, bool compact) const
 {
   int status = 0;
   fitsfile* ff;
@@ -34,10 +82,23 @@ Pars::loadEventFile() const
 
   GTITable gti(ff, tm);
 
-  EventTable events(ff);
-  events.filter_tm(tm);
-  events.filter_pi(pimin, pimax);
-  events.filter_gti(gti);
+  // merge any extra GTIs before reading the events, so they are
+  // only selected once
+  if(!gti_fn.empty())
+    {
+      std::printf("Opening GTI file %s\n", gti_fn.c_str());
+      fitsfile* gff;
+      fits_open_file(&gff, gti_fn.c_str(), READONLY, &status);
+      check_fitsio_status(status);
+      GTITable gti2(gff, tm);
+      fits_close_file(gff, &status);
+      check_fitsio_status(status);
+
+      gti &= gti2;
+      std::printf("  - merged GTIs to make %ld elements\n", gti.num);
+    }
+
+  EventTable events(ff, tm, pimin, pimax, gti, evtcols, compact);
 
   AttitudeTable att(ff, tm);
   DetMap detmap(tm, detmapmask, shadowmask);
@@ -47,31 +108,90 @@ Pars::loadEventFile() const
   fits_close_file(ff, &status);
   check_fitsio_status(status);
 
-  if(!gti_fn.empty())
+  if(!bpix_fn.empty())
     {
-      std::printf("Opening GTI file %s\n", gti_fn.c_str());
-      fits_open_file(&ff, gti_fn.c_str(), READONLY, &status);
+      detmap.read(bpix_fn);
+    }
+
+  return std::make_tuple(std::move(events), gti, att, detmap, deadc);
+}
+
+void Pars::loadCatalog()
+{
+  if(catalog_fn.empty())
+    return;
+
+  std::printf("Reading source catalog %s\n", catalog_fn.c_str());
+  const size_t numbefore = sources.size();
+
+  // FITS files start with SIMPLE (or may be gzip compressed)
+  std::ifstream in(catalog_fn, std::ios::binary);
+  if(!in)
+    throw std::runtime_error("Cannot open catalog " + catalog_fn);
+  char magic[6] = {0};
+  in.read(magic, 6);
+  const bool isfits = std::memcmp(magic, "SIMPLE", 6) == 0 ||
+    (magic[0] == '\x1f' && magic[1] == '\x8b');
+
+  if(isfits)
+    {
+      // RA and DEC columns from the first table
+      int status = 0;
+      fitsfile* ff;
+      fits_open_table(&ff, catalog_fn.c_str(), READONLY, &status);
       check_fitsio_status(status);
-      GTITable gti2(ff, tm);
+
+      long nrows;
+      fits_get_num_rows(ff, &nrows, &status);
+      check_fitsio_status(status);
+
+      std::vector<double> ra(nrows), dec(nrows);
+      if(nrows > 0)
+        {
+          read_fits_column(ff, "RA", TDOUBLE, nrows, ra.data());
+          read_fits_column(ff, "DEC", TDOUBLE, nrows, dec.data());
+        }
+
       fits_close_file(ff, &status);
       check_fitsio_status(status);
 
-      gti &= gti2;
-      std::printf("  - merged GTIs to make %ld elements\n", gti.num);
-      events.filter_gti(gti);
+      for(long i=0; i<nrows; ++i)
+        sources.push_back({ra[i], dec[i]});
     }
-
-  if(!bpix_fn.empty())
+  else
     {
-      detmap.read(bpix_fn);
+      // text file with ra,dec (comma or space separated) on each
+      // line, ignoring comments and lines not starting with a number
+      in.clear();
+      in.seekg(0);
+      std::string line;
+      size_t lineno = 0;
+      while(std::getline(in, line))
+        {
+          ++lineno;
+          line = line.substr(0, line.find('#'));
+          std::replace(line.begin(), line.end(), ',', ' ');
+
+          std::istringstream ss(line);
+          double ra, dec;
+          if(!(ss >> ra))
+            continue;
+          if(!(ss >> dec))
+            throw std::runtime_error("Invalid line " + std::to_string(lineno) +
+                                     " in catalog " + catalog_fn);
+          sources.push_back({ra, dec});
+        }
     }
 
-  return std::make_tuple(events, gti, att, detmap, deadc);
+  num_catalog = sources.size() - numbefore;
+  std::printf("  - read %ld sources\n", num_catalog);
 }
 
 void Pars::showSources() const
 {
   std::printf("Defined %ld source(s)\n", sources.size());
+  if(sources.size() > max_show_sources)
+    return;
   for(auto& src : sources)
     std::printf("  - source (%g,%g)\n", src[0], src[1]);
 }
@@ -90,25 +210,12 @@ Mask Pars::loadMask() const
 
 std::unique_ptr<ProjMode> Pars::createProjMode() const
 {
-  switch(projmode)
-    {
-    case AVERAGE_FOV:
-      return std::make_unique<ProjModeAverageFoV>();
-    case AVERAGE_FOV_SKY:
-      return std::make_unique<ProjModeAverageFoVSky>();
-    case AVERAGE_FULL:
-      return std::make_unique<ProjModeAverageFull>();
-    case WHOLE_DET:
-      return std::make_unique<ProjModeDet>();
-    case RADIAL:
-      return std::make_unique<ProjModeRadial>(projargs);
-    case RADIAL_SYM:
-      return std::make_unique<ProjModeRadialSym>(projargs);
-    case BOX:
-      return std::make_unique<ProjModeBox>(projargs);
-    default:
-      throw std::runtime_error("Invalid mode");
-    }
+  std::unique_ptr<ProjMode> retn;
+  withProjMode([&retn](const auto& mode)
+               {
+                 retn = std::make_unique<std::decay_t<decltype(mode)>>(mode);
+               });
+  return retn;
 }
 
 Point Pars::imageCentre() const
@@ -156,8 +263,15 @@ std::vector<std::string> Pars::getHeaders() const
   std::vector<std::string> hdrs;
 
   hdrs.emplace_back("--tm=" + std::to_string(tm));
-  if(!sources.empty())
-    hdrs.emplace_back("--sources " + str_list(sources));
+  // sources from the catalog are not listed
+  if(sources.size() > num_catalog)
+    {
+      const std::vector<std::array<double,2>> cmdsrcs(sources.begin(),
+                                                      sources.end()-num_catalog);
+      hdrs.emplace_back("--sources " + str_list(cmdsrcs));
+    }
+  if(!catalog_fn.empty())
+    hdrs.emplace_back("--catalog=" + catalog_fn);
 
   hdrs.emplace_back("--pi-min=" + std::to_string(pimin));
   hdrs.emplace_back("--pi-max=" + std::to_string(pimax));
@@ -171,6 +285,24 @@ std::vector<std::string> Pars::getHeaders() const
   hdrs.emplace_back("--yw=" + std::to_string(yw));
   hdrs.emplace_back("--pixsize=" + std::to_string(pixsize));
   hdrs.emplace_back("--delta-t=" + std::to_string(deltat));
+  if(adaptive_tol > 0)
+    hdrs.emplace_back("--adaptive-tol=" + std::to_string(adaptive_tol));
+  hdrs.emplace_back("--vis-stride=" + std::to_string(vis_stride));
+  hdrs.emplace_back("--expos-method=" + std::to_string(exposmethod));
+  if(posebin)
+    {
+      hdrs.emplace_back("--pose-bin");
+      hdrs.emplace_back("--pose-tol-pix=" + std::to_string(pose_tol_pix));
+      hdrs.emplace_back("--pose-tol-deg=" + std::to_string(pose_tol_deg));
+    }
+  if(prefilter)
+    hdrs.emplace_back("--prefilter");
+  if(event_group_dt > 0)
+    hdrs.emplace_back("--event-group-dt=" + std::to_string(event_group_dt));
+  if(compact_events)
+    hdrs.emplace_back("--compact-events");
+  if(ordered_events)
+    hdrs.emplace_back("--ordered-events");
 
   if(!mask_fn.empty())
     hdrs.emplace_back("--mask=" + mask_fn);
@@ -180,6 +312,17 @@ std::vector<std::string> Pars::getHeaders() const
   if(!gti_fn.empty())
     hdrs.emplace_back("--gti=" + gti_fn);
 
+  if(mode == MULTI)
+    {
+      hdrs.emplace_back("--products " + str_list(products));
+      if(!image_out_fn.empty())
+        hdrs.emplace_back("--image-out=" + image_out_fn);
+      if(!expos_out_fn.empty())
+        hdrs.emplace_back("--expos-out=" + expos_out_fn);
+      if(!event_out_fn.empty())
+        hdrs.emplace_back("--event-out=" + event_out_fn);
+    }
+
   hdrs.emplace_back(std::to_string(mode));
   hdrs.emplace_back(evt_fn);
   hdrs.emplace_back(out_fn);
@@ -3,6 +3,7 @@
 
 #include <array>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -21,13 +22,24 @@ class Pars
 {
 public:
   Pars();
+  // load tables from event file, keeping the event columns given
+  // (see EventTable::columns), using the cache directory if set
   std::tuple<EventTable,GTITable,
              AttitudeTable,DetMap,
-             DeadCorTable> loadEventFile() const;
+             DeadCorTable> loadEventFile(unsigned evtcols) const;
+  // load tables from event file without using the cache
+  std::tuple<EventTable,GTITable,
+             AttitudeTable,DetMap,
+             DeadCorTable> readEventFile(unsigned evtcols, bool compact) const;
+  // append sources in catalog file (if any) to sources
+  void loadCatalog();
   void showSources() const;
   InstPar loadInstPar() const;
   Mask loadMask() const;
   std::unique_ptr<ProjMode> createProjMode() const;
+  // call func with the projection mode as its concrete class, so
+  // code can be specialized for each mode
+  template<class F> void withProjMode(F&& func) const;
   Point imageCentre() const;
 
   std::vector<std::string> getHeaders() const;
@@ -41,17 +53,27 @@ public:
     BOX
   };
 
-  enum runmodetype : int { IMAGE, EXPOS, EVENT };
+  enum runmodetype : int { IMAGE, EXPOS, EVENT, MULTI, CACHE };
+
+  // how to compute exposure maps
+  enum exposmethodtype : int { EXPOS_RASTER, EXPOS_CORR, EXPOS_AREA };
 
 public:
   // Mode to use
   runmodetype mode;
 
+  // products to make in multi mode
+  std::vector<runmodetype> products;
+
   // TM to process
   int tm;
 
   // source position(s) ra,dec
   std::vector<std::array<double,2>> sources;
+  // number of sources at end of sources read from catalog
+  size_t num_catalog;
+  // only list sources individually if there are at most this many
+  static constexpr size_t max_show_sources = 20;
 
   // PI range
   float pimin, pimax;
@@ -85,15 +107,82 @@ public:
   // time delta for exposure map
   double deltat;
 
+  // if >0, choose exposure map time steps so that the detector moves
+  // by less than this relative to the source (detector pixels)
+  double adaptive_tol;
+
   // sample mode for exposure map
   int samples;
 
+  // time stride for searching for source visibility (s)
+  double vis_stride;
+
+  // method for computing exposure map
+  exposmethodtype exposmethod;
+
+  // combine time steps with the same detector pose in exposure map
+  bool posebin;
+  // tolerances for pose binning (output pixels and degrees)
+  float pose_tol_pix, pose_tol_deg;
+
+  // average detector map over output pixel size in exposure map
+  bool prefilter;
+
+  // events within this time use the same pointing (image/event mode)
+  double event_group_dt;
+
+  // store events in the compact layout (image/event mode)
+  bool compact_events;
+
+  // write output events in a reproducible order (event mode)
+  bool ordered_events;
+
+  // remove stale entries from cache directory (cache mode)
+  bool cache_prune;
+
   // filenames
   std::string evt_fn;
   std::string mask_fn;
   std::string out_fn;
+  // separate output files for products in multi mode (if set)
+  std::string image_out_fn;
+  std::string expos_out_fn;
+  std::string event_out_fn;
   std::string gti_fn;
   std::string bpix_fn;
+  std::string catalog_fn;
+  // directory for cached tables from event files (if set)
+  std::string cache_dir;
 };
 
+template<class F> void Pars::withProjMode(F&& func) const
+{
+  switch(projmode)
+    {
+    case AVERAGE_FOV:
+      func(ProjModeAverageFoV());
+      break;
+    case AVERAGE_FOV_SKY:
+      func(ProjModeAverageFoVSky());
+      break;
+    case AVERAGE_FULL:
+      func(ProjModeAverageFull());
+      break;
+    case WHOLE_DET:
+      func(ProjModeDet());
+      break;
+    case RADIAL:
+      func(ProjModeRadial(projargs));
+      break;
+    case RADIAL_SYM:
+      func(ProjModeRadialSym(projargs));
+      break;
+    case BOX:
+      func(ProjModeBox(projargs));
+      break;
+    default:
+      throw std::runtime_error("Invalid mode");
+    }
+}
+
 #endif
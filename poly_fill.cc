@@ -74,10 +74,10 @@ inline int nextwrap(int i, int npts)
   return (i+1==npts) ? 0 : i+1;
 }
 
-void fillPoly(const Poly& poly, Image<float>& outimg, float val)
+// call fn(y, xlo, xhi) for each span of pixels in polygon
+template<class Fn>
+static void forEachPolySpan(const Poly& poly, int xw, int yw, Fn fn)
 {
-  const int xw = outimg.xw;
-  const int yw = outimg.yw;
   const int npts = poly.size();
 
   const Rect bounds = poly.bounds();
@@ -114,20 +114,86 @@ void fillPoly(const Poly& poly, Image<float>& outimg, float val)
         }
       sortSmall(xs);
 
-      // fill in pixels between pairs of points where it cross a line
+      // pixels between pairs of points where it cross a line
       const int nxs = xs.size();
       for(int i=0; i+1 < nxs; i+= 2)
         {
           const int xlo = std::max(int(std::ceil(xs[i])), 0);
           const int xhi = std::min(int(std::floor(xs[i+1])), xw-1);
-          // little optimization as we're accessing pixels on a line
-          for(int x=xlo; x<=xhi; ++x)
-            outimg.arr[y*xw+x] = val;
+          if(xlo <= xhi)
+            fn(y, xlo, xhi);
         }
       xs.clear();
     }
 }
 
+void fillPoly(const Poly& poly, Image<float>& outimg, float val)
+{
+  const int xw = outimg.xw;
+  forEachPolySpan(poly, outimg.xw, outimg.yw,
+                  [&](int y, int xlo, int xhi)
+                  {
+                    // little optimization as we're accessing pixels on a line
+                    for(int x=xlo; x<=xhi; ++x)
+                      outimg.arr[y*xw+x] = val;
+                  });
+}
+
+PolySpans::PolySpans(const PolyVec& polys, int xw, int yw)
+  : rowidx(yw+1, 0)
+{
+  // collect spans with their rows
+  std::vector<std::pair<int,Span>> rowspans;
+  for(auto& poly : polys)
+    forEachPolySpan(poly, xw, yw,
+                    [&](int y, int xlo, int xhi)
+                    {
+                      rowspans.emplace_back(y, Span(xlo, xhi));
+                    });
+
+  std::sort(rowspans.begin(), rowspans.end(),
+            [](const std::pair<int,Span>& a, const std::pair<int,Span>& b)
+            {
+              return a.first<b.first ||
+                (a.first==b.first && a.second.x1<b.second.x1);
+            });
+
+  // merge overlapping spans on each row and count spans per row
+  allspans.reserve(rowspans.size());
+  int lasty = -1;
+  for(auto& [y, span] : rowspans)
+    {
+      if(y == lasty && span.x1 <= allspans.back().x2+1)
+        allspans.back().x2 = std::max(allspans.back().x2, span.x2);
+      else
+        {
+          allspans.push_back(span);
+          ++rowidx[y+1];
+          lasty = y;
+        }
+    }
+  for(int y=0; y<yw; ++y)
+    rowidx[y+1] += rowidx[y];
+}
+
+void subtractSpans(int xlo, int xhi, const Span* cut, int ncut, SpanVec& out)
+{
+  out.clear();
+  int x = xlo;
+  for(int i=0; i<ncut && x<=xhi; ++i)
+    {
+      if(cut[i].x2 < x)
+        continue;
+      if(cut[i].x1 > xhi)
+        break;
+      if(cut[i].x1 > x)
+        out.emplace_back(x, cut[i].x1-1);
+      x = cut[i].x2+1;
+    }
+  if(x <= xhi)
+    out.emplace_back(x, xhi);
+}
+
 namespace
 {
 
@@ -2,6 +2,7 @@
 #define POLY_FILL_HH
 
 #include <cstdint>
+#include <vector>
 
 #include "geom.hh"
 #include "image.hh"
@@ -11,4 +12,33 @@ void fillPoly(const Poly& poly, Image<float>& outimg, float val);
 void fillPoly2(const PolyVec& detpoly, const PolyVec& maskpoly,
                Image<float>& outimg, float fillval);
 
+// inclusive range of pixels x1 to x2 on a scan line
+struct Span
+{
+  Span() : x1(0), x2(-1) {}
+  Span(int _x1, int _x2) : x1(_x1), x2(_x2) {}
+  int x1, x2;
+};
+
+typedef std::vector<Span> SpanVec;
+
+// Pixels inside a set of polygons as spans on each scan line, using
+// the same rule for pixel inclusion as fillPoly. Spans on each line
+// are sorted and do not overlap.
+class PolySpans
+{
+public:
+  PolySpans(const PolyVec& polys, int xw, int yw);
+
+  int numSpans(int y) const { return rowidx[y+1]-rowidx[y]; }
+  const Span* spans(int y) const { return allspans.data()+rowidx[y]; }
+
+private:
+  std::vector<int> rowidx;
+  SpanVec allspans;
+};
+
+// get the parts of the range xlo to xhi not in the sorted spans cut
+void subtractSpans(int xlo, int xhi, const Span* cut, int ncut, SpanVec& out);
+
 #endif
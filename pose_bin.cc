@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+
+#include "pose_bin.hh"
+#include "common.hh"
+#include "coords.hh"
+
+namespace
+{
+  // quantized pose of detector
+  struct PoseKey
+  {
+    long qx, qy, qroll;
+    int epoch;
+    size_t maskkey;
+
+    bool operator<(const PoseKey& o) const
+    {
+      return std::tie(qx, qy, qroll, epoch, maskkey) <
+        std::tie(o.qx, o.qy, o.qroll, o.epoch, o.maskkey);
+    }
+  };
+
+  struct PoseBin
+  {
+    TimeSeg seg;
+    int epoch;
+    size_t nsteps;
+    double dtsum;
+    // time-weighted sums of position and roll relative to seg.roll
+    double xsum, ysum, rollsum;
+    // distance of closest step to mean pose (in tolerances)
+    double mindist;
+  };
+
+  // wrap angle in degrees to range -180 to 180
+  inline double wrap_deg(double a)
+  {
+    return a - 360*std::floor((a+180)/360);
+  }
+
+  struct UnitVec
+  {
+    UnitVec(double ra, double dec)
+    {
+      double cosdec = std::cos(dec*DEG2RAD);
+      x = cosdec*std::cos(ra*DEG2RAD);
+      y = cosdec*std::sin(ra*DEG2RAD);
+      z = std::sin(dec*DEG2RAD);
+    }
+    double dot(const UnitVec& o) const { return x*o.x + y*o.y + z*o.z; }
+    double x, y, z;
+  };
+
+  // combine hash value v into h (FNV-1a style)
+  inline void hash_combine(size_t& h, size_t v)
+  {
+    h = (h ^ v) * size_t(1099511628211ULL);
+  }
+}
+
+std::vector<TimeSeg> binPoses(const std::vector<TimeSeg>& timesegs,
+                              const Pars& pars,
+                              AttitudeTable& att, const DetMap& detmap,
+                              const Mask& mask, const InstPar& instpar)
+{
+  std::printf("  - binning %ld time steps by pose (tolerance %g pix, %g deg)\n",
+              timesegs.size(), pars.pose_tol_pix, pars.pose_tol_deg);
+
+  if(pars.pose_tol_pix <= 0 || pars.pose_tol_deg <= 0)
+    throw std::runtime_error("Pose tolerances must be positive");
+
+  // tolerance is in output pixels, so convert to detector pixels
+  const double tolpix = pars.pose_tol_pix * pars.pixsize;
+  const double toldeg = pars.pose_tol_deg;
+
+  // masked regions which could be visible are those within the
+  // radius of the detector (half diagonal) plus their own radius
+  const double pixscale = instpar.pixscale_x;
+  const double detrad = 0.5*std::sqrt(sqr(double(CCD_XW))+sqr(double(CCD_YW))) *
+    pixscale;
+  std::vector<SkyCircle> circles = mask.boundingCircles(pixscale);
+  std::vector<UnitVec> circvecs;
+  std::vector<double> circcos;
+  for(auto& c : circles)
+    {
+      circvecs.emplace_back(c.ra, c.dec);
+      circcos.push_back(std::cos(std::min(detrad+c.rad, 180.)*DEG2RAD));
+    }
+
+  const long nqroll = std::lround(180 / toldeg);
+
+  std::map<PoseKey, size_t> lookup;
+  std::vector<PoseBin> bins;
+  // bin of each segment
+  std::vector<size_t> segbin;
+  segbin.reserve(timesegs.size());
+
+  for(auto& seg : timesegs)
+    {
+      PoseKey key;
+      key.qx = std::lround(seg.src_ccdx / tolpix);
+      key.qy = std::lround(seg.src_ccdy / tolpix);
+      // the +180 bin is the same as the -180 bin
+      key.qroll = std::lround(wrap_deg(seg.roll) / toldeg);
+      if(key.qroll == nqroll)
+        key.qroll = -nqroll;
+      key.epoch = detmap.epochIndex(seg.t);
+
+      // the masks move relative to the detector depending on the
+      // source, so include source and which masks are visible
+      key.maskkey = 0;
+      if(!circles.empty())
+        {
+          hash_combine(key.maskkey, std::hash<double>()(seg.src_ra));
+          hash_combine(key.maskkey, std::hash<double>()(seg.src_dec));
+          auto [att_ra, att_dec, att_roll] = att.interpolate(seg.t);
+          UnitVec pointing(att_ra, att_dec);
+          for(size_t i=0; i != circles.size(); ++i)
+            if(pointing.dot(circvecs[i]) >= circcos[i])
+              hash_combine(key.maskkey, i+1);
+        }
+
+      auto [it, inserted] = lookup.emplace(key, bins.size());
+      if(inserted)
+        bins.push_back({seg, key.epoch, 0, 0., 0., 0., 0., 0.});
+
+      PoseBin& bin = bins[it->second];
+      bin.nsteps += 1;
+      bin.dtsum += seg.dt;
+      bin.xsum += seg.dt * seg.src_ccdx;
+      bin.ysum += seg.dt * seg.src_ccdy;
+      bin.rollsum += seg.dt * wrap_deg(seg.roll - bin.seg.roll);
+      segbin.push_back(it->second);
+    }
+
+  // render each pose at its time-weighted mean position and roll
+  for(auto& bin : bins)
+    {
+      bin.mindist = std::numeric_limits<double>::max();
+      if(bin.dtsum > 0)
+        {
+          bin.seg.src_ccdx = float(bin.xsum / bin.dtsum);
+          bin.seg.src_ccdy = float(bin.ysum / bin.dtsum);
+          bin.seg.roll += bin.rollsum / bin.dtsum;
+        }
+    }
+
+  // the masks and bad pixels are taken at the time of the step
+  // closest to the mean pose
+  for(size_t i=0; i != timesegs.size(); ++i)
+    {
+      const TimeSeg& seg = timesegs[i];
+      PoseBin& bin = bins[segbin[i]];
+      const double dist = std::max({
+          std::abs(seg.src_ccdx - bin.seg.src_ccdx) / tolpix,
+          std::abs(seg.src_ccdy - bin.seg.src_ccdy) / tolpix,
+          std::abs(wrap_deg(seg.roll - bin.seg.roll)) / toldeg});
+      if(dist < bin.mindist)
+        {
+          bin.mindist = dist;
+          bin.seg.t = seg.t;
+          bin.seg.src_ra = seg.src_ra;
+          bin.seg.src_dec = seg.src_dec;
+        }
+    }
+
+  std::printf("    - found %ld distinct poses (%.1fx fewer renders)\n",
+              bins.size(), bins.empty() ? 0. : double(timesegs.size())/bins.size());
+
+  // show the poses with the most time
+  std::vector<size_t> order(bins.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&bins](size_t a, size_t b)
+                   { return bins[a].dtsum > bins[b].dtsum; });
+  constexpr size_t maxshow = 20;
+  for(size_t i=0; i != std::min(order.size(), maxshow); ++i)
+    {
+      const PoseBin& bin = bins[order[i]];
+      std::printf("    - pose (%.2f,%.2f) roll=%.3f epoch=%d: %ld steps, %.2f s\n",
+                  bin.seg.src_ccdx, bin.seg.src_ccdy, bin.seg.roll, bin.epoch,
+                  bin.nsteps, bin.dtsum);
+    }
+  if(order.size() > maxshow)
+    std::printf("    - ... %ld further poses\n", order.size()-maxshow);
+
+  // mean pose for each pose, with the total time
+  std::vector<TimeSeg> outsegs;
+  outsegs.reserve(bins.size());
+  for(auto& bin : bins)
+    {
+      TimeSeg seg = bin.seg;
+      seg.idx = outsegs.size();
+      seg.dt = float(bin.dtsum);
+      outsegs.push_back(seg);
+    }
+  return outsegs;
+}
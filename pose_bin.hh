@@ -0,0 +1,20 @@
+#ifndef POSE_BIN_HH
+#define POSE_BIN_HH
+
+#include <vector>
+
+#include "pars.hh"
+#include "timeseg.hh"
+
+// Combine time segments which have the same detector pose (source
+// CCD position, roll, bad pixel epoch and visible masks) to within
+// the tolerances in pars. Each returned segment has the time-weighted
+// mean source position and roll of its pose, the time of the segment
+// closest to that mean, and dt the total time of all segments in the
+// pose.
+std::vector<TimeSeg> binPoses(const std::vector<TimeSeg>& timesegs,
+                              const Pars& pars,
+                              AttitudeTable& att, const DetMap& detmap,
+                              const Mask& mask, const InstPar& instpar);
+
+#endif
@@ -1,4 +1,3 @@
-#include <cmath>
 #include <cstdio>
 #include <stdexcept>
 
@@ -7,26 +6,6 @@
 
 // FIXME: assumption centre of coords is 192,192
 
-Matrix2 ProjMode::rotationMatrix(double roll, Point delccd) const
-{
-  return Matrix2();
-}
-
-Point ProjMode::origin(Point ccdpt) const
-{
-  return ccdpt;
-}
-
-////////////////////////////////////////////////////////////////////
-
-bool ProjModeAverageFoV::sourceValid(Point ccdpt) const
-{
-  float rad2 = sqr(ccdpt.x-192) + sqr(ccdpt.y-192);
-
-  // FIXME: check radius
-  return rad2 < sqr(192);
-}
-
 void ProjModeAverageFoV::message() const
 {
   std::printf("Projection mode\n");
@@ -35,21 +14,6 @@ void ProjModeAverageFoV::message() const
 
 ////////////////////////////////////////////////////////////////////
 
-bool ProjModeAverageFoVSky::sourceValid(Point ccdpt) const
-{
-  float rad2 = sqr(ccdpt.x-192) + sqr(ccdpt.y-192);
-
-  // FIXME: check radius
-  return rad2 < sqr(192);
-}
-
-Matrix2 ProjModeAverageFoVSky::rotationMatrix(double roll, Point delccd) const
-{
-  float c = std::cos((270-roll)*DEG2RAD);
-  float s = std::sin((270-roll)*DEG2RAD);
-  return Matrix2(c, -s, s, c);
-}
-
 void ProjModeAverageFoVSky::message() const
 {
   std::printf("Projection mode\n");
@@ -58,11 +22,6 @@ void ProjModeAverageFoVSky::message() const
 
 ////////////////////////////////////////////////////////////////////
 
-bool ProjModeAverageFull::sourceValid(Point ccdpt) const
-{
-  return true;
-}
-
 void ProjModeAverageFull::message() const
 {
   std::printf("Projection mode\n");
@@ -71,17 +30,6 @@ void ProjModeAverageFull::message() const
 
 ////////////////////////////////////////////////////////////////////
 
-
-Point ProjModeDet::origin(Point ccdpt) const
-{
-  return Point(192,192);
-}
-
-bool ProjModeDet::sourceValid(Point ccdpt) const
-{
-  return true;
-}
-
 void ProjModeDet::message() const
 {
   std::printf("Projection mode\n");
@@ -110,12 +58,6 @@ ProjModeRadial::ProjModeRadial(const std::vector<float>& args)
     }
 }
 
-bool ProjModeRadial::sourceValid(Point ccdpt) const
-{
-  float rad = std::sqrt(sqr(ccdpt.x-cx) + sqr(ccdpt.y-cy));
-  return (rad >= rin) && (rad < rout);
-}
-
 void ProjModeRadial::message() const
 {
   std::printf("Projection mode\n");
@@ -132,14 +74,6 @@ void ProjModeRadialSym::message() const
               rin, rout, cx, cy);
 }
 
-Matrix2 ProjModeRadialSym::rotationMatrix(double roll, Point delccd) const
-{
-  float theta = -std::atan2(delccd.y, delccd.x);
-  float s = std::sin(theta);
-  float c = std::cos(theta);
-  return Matrix2(c, -s, s, c);
-}
-
 ////////////////////////////////////////////////////////////////////
 
 ProjModeBox::ProjModeBox(const std::vector<float>& args)
@@ -153,12 +87,6 @@ ProjModeBox::ProjModeBox(const std::vector<float>& args)
   y2 = args[3];
 }
 
-bool ProjModeBox::sourceValid(Point ccdpt) const
-{
-  return (ccdpt.x >= x1 && ccdpt.y >= y1 &&
-          ccdpt.x <  x2 && ccdpt.y <  y2);
-}
-
 void ProjModeBox::message() const
 {
   std::printf("Projection mode\n");
@@ -1,57 +1,105 @@
 #ifndef MODE_HH
 #define MODE_HH
 
+#include <cmath>
+#include <vector>
+
+#include "common.hh"
 #include "geom.hh"
 
+// The per-source functions of the concrete modes are defined inline
+// here, so that code templated on the mode class (see
+// Pars::withProjMode) can inline them rather than making virtual
+// calls.
+
 class ProjMode
 {
 public:
+  virtual ~ProjMode() {}
+
   // use source when it's in the current position?
   virtual bool sourceValid(Point ccdpt) const = 0;
 
   // get matrix to rotate photons or exposure
-  virtual Matrix2 rotationMatrix(double roll, Point delccd) const;
+  virtual Matrix2 rotationMatrix(double roll, Point delccd) const
+  {
+    return Matrix2();
+  }
 
   // origin to use given source
-  virtual Point origin(Point ccdpt) const;
+  virtual Point origin(Point ccdpt) const
+  {
+    return ccdpt;
+  }
+
+  // does rotationMatrix return anything other than the identity?
+  virtual bool hasRotation() const { return rotation; }
+  static constexpr bool rotation = false;
+
+  // maximum distance from pt of a valid source position, or a
+  // negative value if sources are valid anywhere
+  virtual float maxValidDistance(Point pt) const { return -1; }
 
   // show message to user
   virtual void message() const = 0;
 };
 
 // average field of view, in CCD coordinates
-class ProjModeAverageFoV : public ProjMode
+class ProjModeAverageFoV final : public ProjMode
 {
 public:
-  bool sourceValid(Point ccdpt) const;
-  void message() const;
+  bool sourceValid(Point ccdpt) const override
+  {
+    // FIXME: check radius
+    return sqr(ccdpt.x-192) + sqr(ccdpt.y-192) < sqr(192.f);
+  }
+  float maxValidDistance(Point pt) const override
+  {
+    return std::sqrt(sqr(pt.x-192) + sqr(pt.y-192)) + 192;
+  }
+  void message() const override;
 };
 
 // average FoV, in sky-relative coordinates
-class ProjModeAverageFoVSky : public ProjMode
+class ProjModeAverageFoVSky final : public ProjMode
 {
 public:
-  bool sourceValid(Point ccdpt) const;
-  Matrix2 rotationMatrix(double roll, Point delccd) const;
-  void message() const;
+  bool sourceValid(Point ccdpt) const override
+  {
+    // FIXME: check radius
+    return sqr(ccdpt.x-192) + sqr(ccdpt.y-192) < sqr(192.f);
+  }
+  float maxValidDistance(Point pt) const override
+  {
+    return std::sqrt(sqr(pt.x-192) + sqr(pt.y-192)) + 192;
+  }
+  Matrix2 rotationMatrix(double roll, Point delccd) const override
+  {
+    float c = std::cos((270-roll)*DEG2RAD);
+    float s = std::sin((270-roll)*DEG2RAD);
+    return Matrix2(c, -s, s, c);
+  }
+  bool hasRotation() const override { return rotation; }
+  static constexpr bool rotation = true;
+  void message() const override;
 };
 
 // average field of view, in CCD coordinates
 // in this mode, we use all photons from the source, even if the source is outside the FoV
-class ProjModeAverageFull : public ProjMode
+class ProjModeAverageFull final : public ProjMode
 {
 public:
-  bool sourceValid(Point ccdpt) const;
-  void message() const;
+  bool sourceValid(Point ccdpt) const override { return true; }
+  void message() const override;
 };
 
 // mode for testing - just Det coordinates without tracking source
-class ProjModeDet : public ProjMode
+class ProjModeDet final : public ProjMode
 {
 public:
-  bool sourceValid(Point ccdpt) const;
-  Point origin(Point ccdpt) const;
-  void message() const;
+  bool sourceValid(Point ccdpt) const override { return true; }
+  Point origin(Point ccdpt) const override { return Point(192,192); }
+  void message() const override;
 };
 
 // radial region
@@ -59,27 +107,56 @@ class ProjModeRadial : public ProjMode
 {
 public:
   ProjModeRadial(const std::vector<float>& args);
-  bool sourceValid(Point ccdpt) const;
-  void message() const;
+  bool sourceValid(Point ccdpt) const override
+  {
+    float rad = std::sqrt(sqr(ccdpt.x-cx) + sqr(ccdpt.y-cy));
+    return (rad >= rin) && (rad < rout);
+  }
+  float maxValidDistance(Point pt) const override
+  {
+    return std::sqrt(sqr(pt.x-cx) + sqr(pt.y-cy)) + rout;
+  }
+  void message() const override;
 
   float rin, rout;
   float cx, cy;
 };
 
-class ProjModeRadialSym : public ProjModeRadial
+class ProjModeRadialSym final : public ProjModeRadial
 {
 public:
   ProjModeRadialSym(const std::vector<float>& args) : ProjModeRadial(args) {}
-  Matrix2 rotationMatrix(double roll, Point delccd) const;
-  void message() const;
+
+  // rotate by -atan2(dy,dx), computed without trigonometric functions
+  Matrix2 rotationMatrix(double roll, Point delccd) const override
+  {
+    float r = std::sqrt(sqr(delccd.x) + sqr(delccd.y));
+    if(r == 0)
+      return Matrix2();
+    float c = delccd.x / r;
+    float s = -delccd.y / r;
+    return Matrix2(c, -s, s, c);
+  }
+  bool hasRotation() const override { return rotation; }
+  static constexpr bool rotation = true;
+  void message() const override;
 };
 
-class ProjModeBox : public ProjMode
+class ProjModeBox final : public ProjMode
 {
 public:
   ProjModeBox(const std::vector<float>& args);
-  bool sourceValid(Point ccdpt) const;
-  void message() const;
+  bool sourceValid(Point ccdpt) const override
+  {
+    return (ccdpt.x >= x1 && ccdpt.y >= y1 &&
+            ccdpt.x <  x2 && ccdpt.y <  y2);
+  }
+  float maxValidDistance(Point pt) const override
+  {
+    return std::sqrt(std::max(sqr(pt.x-x1), sqr(pt.x-x2)) +
+                     std::max(sqr(pt.y-y1), sqr(pt.y-y2)));
+  }
+  void message() const override;
 
   float x1, y1, x2, y2;
 };
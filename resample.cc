@@ -0,0 +1,215 @@
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLE_X86
+#endif
+
+#include "common.hh"
+#include "resample.hh"
+
+// Multiplies and adds must not be contracted into FMAs (which
+// avx512f enables), so that each variant rounds identically.
+#pragma GCC optimize ("fp-contract=off")
+
+// the funny +16. -16 is to ensure correct rounding around zero
+// without this -0.5 is rounded 0 due to truncation
+constexpr float ROUND_OFFSET = 16.f-0.5f;
+
+static inline void resamplePixel(const float* dmap, float* outrow, int x,
+                                 const ResampleRowPars& p)
+{
+  const float px = float(x) - p.cx;
+  const float detx = (px*p.m00 + p.rowx) + p.ox;
+  const float dety = (px*p.m10 + p.rowy) + p.oy;
+  const int dix = int(detx+ROUND_OFFSET)-16;
+  const int diy = int(dety+ROUND_OFFSET)-16;
+
+  if(dix>=0 && diy>=0 && dix<int(CCD_XW) && diy<int(CCD_YW))
+    outrow[x] = dmap[diy*int(CCD_XW)+dix];
+  else
+    outrow[x] = 0.f;
+}
+
+[[maybe_unused]] static void resampleRowScalar(const float* dmap, float* outrow,
+                              int xlo, int xhi, const ResampleRowPars& p)
+{
+  for(int x=xlo; x<=xhi; ++x)
+    resamplePixel(dmap, outrow, x, p);
+}
+
+#ifdef RESAMPLE_X86
+
+// SSE2 is always available on x86-64, but has no gather instruction
+static void resampleRowSSE2(const float* dmap, float* outrow,
+                            int xlo, int xhi, const ResampleRowPars& p)
+{
+  const __m128 cx = _mm_set1_ps(p.cx);
+  const __m128 m00 = _mm_set1_ps(p.m00);
+  const __m128 m10 = _mm_set1_ps(p.m10);
+  const __m128 rowx = _mm_set1_ps(p.rowx);
+  const __m128 rowy = _mm_set1_ps(p.rowy);
+  const __m128 ox = _mm_set1_ps(p.ox);
+  const __m128 oy = _mm_set1_ps(p.oy);
+  const __m128 roff = _mm_set1_ps(ROUND_OFFSET);
+  const __m128i sixteen = _mm_set1_epi32(16);
+  const __m128i minus1 = _mm_set1_epi32(-1);
+  const __m128i xw = _mm_set1_epi32(CCD_XW);
+  const __m128i yw = _mm_set1_epi32(CCD_YW);
+
+  // x coordinates are stepped along the row
+  __m128i xv = _mm_add_epi32(_mm_set1_epi32(xlo), _mm_setr_epi32(0,1,2,3));
+  const __m128i xstep = _mm_set1_epi32(4);
+
+  alignas(16) int32_t ix[4];
+  alignas(16) int32_t iy[4];
+  alignas(16) int32_t valid[4];
+
+  int x = xlo;
+  for(; x+3<=xhi; x+=4)
+    {
+      const __m128 px = _mm_sub_ps(_mm_cvtepi32_ps(xv), cx);
+      const __m128 detx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m00), rowx), ox);
+      const __m128 dety = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, m10), rowy), oy);
+      const __m128i dix = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(detx, roff)), sixteen);
+      const __m128i diy = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(dety, roff)), sixteen);
+
+      const __m128i ok = _mm_and_si128(
+        _mm_and_si128(_mm_cmpgt_epi32(dix, minus1), _mm_cmpgt_epi32(diy, minus1)),
+        _mm_and_si128(_mm_cmplt_epi32(dix, xw), _mm_cmplt_epi32(diy, yw)));
+
+      _mm_store_si128(reinterpret_cast<__m128i*>(ix), dix);
+      _mm_store_si128(reinterpret_cast<__m128i*>(iy), diy);
+      _mm_store_si128(reinterpret_cast<__m128i*>(valid), ok);
+
+      for(int i=0; i<4; ++i)
+        outrow[x+i] = valid[i] ? dmap[iy[i]*int(CCD_XW)+ix[i]] : 0.f;
+
+      xv = _mm_add_epi32(xv, xstep);
+    }
+  for(; x<=xhi; ++x)
+    resamplePixel(dmap, outrow, x, p);
+}
+
+__attribute__((target("avx2")))
+static void resampleRowAVX2(const float* dmap, float* outrow,
+                            int xlo, int xhi, const ResampleRowPars& p)
+{
+  const __m256 cx = _mm256_set1_ps(p.cx);
+  const __m256 m00 = _mm256_set1_ps(p.m00);
+  const __m256 m10 = _mm256_set1_ps(p.m10);
+  const __m256 rowx = _mm256_set1_ps(p.rowx);
+  const __m256 rowy = _mm256_set1_ps(p.rowy);
+  const __m256 ox = _mm256_set1_ps(p.ox);
+  const __m256 oy = _mm256_set1_ps(p.oy);
+  const __m256 roff = _mm256_set1_ps(ROUND_OFFSET);
+  const __m256i sixteen = _mm256_set1_epi32(16);
+  const __m256i minus1 = _mm256_set1_epi32(-1);
+  const __m256i xw = _mm256_set1_epi32(CCD_XW);
+  const __m256i yw = _mm256_set1_epi32(CCD_YW);
+  const __m256 zero = _mm256_setzero_ps();
+
+  __m256i xv = _mm256_add_epi32(_mm256_set1_epi32(xlo),
+                                _mm256_setr_epi32(0,1,2,3,4,5,6,7));
+  const __m256i xstep = _mm256_set1_epi32(8);
+
+  int x = xlo;
+  for(; x+7<=xhi; x+=8)
+    {
+      const __m256 px = _mm256_sub_ps(_mm256_cvtepi32_ps(xv), cx);
+      const __m256 detx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, m00), rowx), ox);
+      const __m256 dety = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, m10), rowy), oy);
+      const __m256i dix = _mm256_sub_epi32(_mm256_cvttps_epi32(_mm256_add_ps(detx, roff)), sixteen);
+      const __m256i diy = _mm256_sub_epi32(_mm256_cvttps_epi32(_mm256_add_ps(dety, roff)), sixteen);
+
+      const __m256i ok = _mm256_and_si256(
+        _mm256_and_si256(_mm256_cmpgt_epi32(dix, minus1), _mm256_cmpgt_epi32(diy, minus1)),
+        _mm256_and_si256(_mm256_cmpgt_epi32(xw, dix), _mm256_cmpgt_epi32(yw, diy)));
+      const __m256i idx = _mm256_add_epi32(_mm256_mullo_epi32(diy, xw), dix);
+
+      const __m256 vals = _mm256_mask_i32gather_ps(zero, dmap, idx,
+                                                   _mm256_castsi256_ps(ok), 4);
+      _mm256_storeu_ps(outrow+x, vals);
+
+      xv = _mm256_add_epi32(xv, xstep);
+    }
+  for(; x<=xhi; ++x)
+    resamplePixel(dmap, outrow, x, p);
+}
+
+// GCC gives spurious warnings about undefined values in AVX-512 intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+static void resampleRowAVX512(const float* dmap, float* outrow,
+                              int xlo, int xhi, const ResampleRowPars& p)
+{
+  const __m512 cx = _mm512_set1_ps(p.cx);
+  const __m512 m00 = _mm512_set1_ps(p.m00);
+  const __m512 m10 = _mm512_set1_ps(p.m10);
+  const __m512 rowx = _mm512_set1_ps(p.rowx);
+  const __m512 rowy = _mm512_set1_ps(p.rowy);
+  const __m512 ox = _mm512_set1_ps(p.ox);
+  const __m512 oy = _mm512_set1_ps(p.oy);
+  const __m512 roff = _mm512_set1_ps(ROUND_OFFSET);
+  const __m512i sixteen = _mm512_set1_epi32(16);
+  const __m512i xw = _mm512_set1_epi32(CCD_XW);
+  const __m512i yw = _mm512_set1_epi32(CCD_YW);
+  const __m512 zero = _mm512_setzero_ps();
+
+  __m512i xv = _mm512_add_epi32(_mm512_set1_epi32(xlo),
+                                _mm512_setr_epi32(0,1,2,3,4,5,6,7,
+                                                  8,9,10,11,12,13,14,15));
+  const __m512i xstep = _mm512_set1_epi32(16);
+
+  int x = xlo;
+  for(; x+15<=xhi; x+=16)
+    {
+      const __m512 px = _mm512_sub_ps(_mm512_cvtepi32_ps(xv), cx);
+      const __m512 detx = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(px, m00), rowx), ox);
+      const __m512 dety = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(px, m10), rowy), oy);
+      const __m512i dix = _mm512_sub_epi32(_mm512_cvttps_epi32(_mm512_add_ps(detx, roff)), sixteen);
+      const __m512i diy = _mm512_sub_epi32(_mm512_cvttps_epi32(_mm512_add_ps(dety, roff)), sixteen);
+
+      // unsigned comparison also rejects negative values
+      const __mmask16 ok = _mm512_cmplt_epu32_mask(dix, xw) &
+        _mm512_cmplt_epu32_mask(diy, yw);
+      const __m512i idx = _mm512_add_epi32(_mm512_mullo_epi32(diy, xw), dix);
+
+      const __m512 vals = _mm512_mask_i32gather_ps(zero, ok, idx, dmap, 4);
+      _mm512_storeu_ps(outrow+x, vals);
+
+      xv = _mm512_add_epi32(xv, xstep);
+    }
+  for(; x<=xhi; ++x)
+    resamplePixel(dmap, outrow, x, p);
+}
+#pragma GCC diagnostic pop
+
+#endif
+
+ResampleRowFunc selectResampleRow(const char** name)
+{
+  const char* dummy;
+  if(name == nullptr)
+    name = &dummy;
+
+#ifdef RESAMPLE_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f"))
+    {
+      *name = "AVX-512";
+      return resampleRowAVX512;
+    }
+  if(__builtin_cpu_supports("avx2"))
+    {
+      *name = "AVX2";
+      return resampleRowAVX2;
+    }
+  *name = "SSE2";
+  return resampleRowSSE2;
+#else
+  *name = "scalar";
+  return resampleRowScalar;
+#endif
+}
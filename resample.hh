@@ -0,0 +1,31 @@
+#ifndef RESAMPLE_HH
+#define RESAMPLE_HH
+
+// Resample the detector map (CCD_XW x CCD_YW) along a row of the
+// output image, for output pixels xlo to xhi (inclusive). Detector
+// coordinates are computed as in Matrix2::apply, i.e.
+//   detx = ((x-cx)*m00 + rowx) + ox
+//   dety = ((x-cx)*m10 + rowy) + oy
+// and rounded to the nearest detector pixel, giving 0 outside the
+// detector. All variants give bitwise-identical results.
+struct ResampleRowPars
+{
+  // x centre of output image
+  float cx;
+  // first column of image->detector matrix
+  float m00, m10;
+  // (y-cy)*m01 and (y-cy)*m11 for this row
+  float rowx, rowy;
+  // detector origin
+  float ox, oy;
+};
+
+typedef void (*ResampleRowFunc)(const float* dmap, float* outrow,
+                                int xlo, int xhi,
+                                const ResampleRowPars& p);
+
+// get fastest resampling function for this CPU, and optionally the
+// name of the variant chosen
+ResampleRowFunc selectResampleRow(const char** name=nullptr);
+
+#endif
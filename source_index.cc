@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cmath>
+
+#include "source_index.hh"
+#include "common.hh"
+
+namespace
+{
+  std::array<double,3> unitVector(double ra, double dec)
+  {
+    const double cosdec = std::cos(dec*DEG2RAD);
+    return { cosdec*std::cos(ra*DEG2RAD), cosdec*std::sin(ra*DEG2RAD),
+        std::sin(dec*DEG2RAD) };
+  }
+}
+
+SourceIndex::SourceIndex(const std::vector<std::array<double,2>>& sources,
+                         double cellsize)
+{
+  nbands = std::clamp(int(std::ceil(180/cellsize)), 1, 180*60);
+  bandh = 180. / nbands;
+
+  // number of cells in each band, given the declination nearest the
+  // equator in the band
+  int ncells = 0;
+  for(int b=0; b<nbands; ++b)
+    {
+      const double declo = -90 + b*bandh;
+      const double dechi = declo + bandh;
+      const double decnear = (declo <= 0 && dechi >= 0) ? 0 :
+        std::min(std::abs(declo), std::abs(dechi));
+      const int n = std::clamp(int(360*std::cos(decnear*DEG2RAD)/cellsize),
+                               1, 360*60);
+      bandcells.push_back(n);
+      bandfirst.push_back(ncells);
+      ncells += n;
+    }
+
+  // count sources in each cell, then order by cell
+  std::vector<int> srccell;
+  srccell.reserve(sources.size());
+  cellstart.assign(ncells+1, 0);
+  for(auto& src : sources)
+    {
+      const int b = bandIndex(src[1]);
+      const int c = bandfirst[b] + cellIndex(b, src[0]);
+      srccell.push_back(c);
+      ++cellstart[c+1];
+      unitvecs.push_back(unitVector(src[0], src[1]));
+    }
+  for(int c=0; c<ncells; ++c)
+    cellstart[c+1] += cellstart[c];
+
+  ids.resize(sources.size());
+  std::vector<size_t> fill(cellstart.begin(), cellstart.end()-1);
+  for(size_t i=0; i != sources.size(); ++i)
+    ids[fill[srccell[i]]++] = i;
+}
+
+int SourceIndex::bandIndex(double dec) const
+{
+  return std::clamp(int(std::floor((dec+90)/bandh)), 0, nbands-1);
+}
+
+int SourceIndex::cellIndex(int band, double ra) const
+{
+  const int n = bandcells[band];
+  ra -= 360*std::floor(ra/360);
+  return std::clamp(int(ra*(n/360.)), 0, n-1);
+}
+
+void SourceIndex::query(double ra, double dec, double radius,
+                        std::vector<size_t>& idxs) const
+{
+  const auto cen = unitVector(ra, dec);
+  const double mincos = std::cos(std::min(radius, 180.)*DEG2RAD);
+
+  // padded radius for finding cells, to avoid rounding problems
+  const double rpad = radius + 1e-6;
+
+  // whether the circle includes a pole
+  const bool pole = std::abs(dec)+rpad >= 90;
+
+  // half-width in RA of circle
+  const double dra = pole ? 180 :
+    std::asin(std::min(std::sin(rpad*DEG2RAD) / std::cos(dec*DEG2RAD), 1.)) *
+    RAD2DEG;
+
+  const int blo = bandIndex(dec-rpad);
+  const int bhi = bandIndex(dec+rpad);
+  for(int b=blo; b<=bhi; ++b)
+    {
+      const int n = bandcells[b];
+
+      // range of cells, which may wrap around
+      int clo = 0, chi = n-1;
+      if(dra < 180)
+        {
+          clo = int(std::floor((ra-dra)*(n/360.)));
+          chi = int(std::floor((ra+dra)*(n/360.)));
+          if(chi-clo+1 >= n)
+            {
+              clo = 0;
+              chi = n-1;
+            }
+        }
+
+      for(int ci=clo; ci<=chi; ++ci)
+        {
+          const int c = bandfirst[b] + ((ci % n) + n) % n;
+          for(size_t j=cellstart[c]; j != cellstart[c+1]; ++j)
+            {
+              const auto& u = unitvecs[ids[j]];
+              if(u[0]*cen[0] + u[1]*cen[1] + u[2]*cen[2] >= mincos)
+                idxs.push_back(ids[j]);
+            }
+        }
+    }
+}
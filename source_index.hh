@@ -0,0 +1,42 @@
+#ifndef SOURCE_INDEX_HH
+#define SOURCE_INDEX_HH
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+// Index of source positions on the sky, to quickly find the sources
+// within a radius of a position. Sources are binned into cells in
+// bands of declination, where the number of cells in each band
+// depends on its declination.
+class SourceIndex
+{
+public:
+  // sources: list of ra,dec (deg)
+  // cellsize: approximate size of cells (deg)
+  SourceIndex(const std::vector<std::array<double,2>>& sources,
+              double cellsize);
+
+  // append indices of sources within radius (deg) of ra,dec to
+  // idxs, in no particular order
+  void query(double ra, double dec, double radius,
+             std::vector<size_t>& idxs) const;
+
+private:
+  int bandIndex(double dec) const;
+  int cellIndex(int band, double ra) const;
+
+private:
+  int nbands;
+  double bandh;
+  // number of cells in each band and index of first cell
+  std::vector<int> bandcells, bandfirst;
+  // start of each cell in ids (one more than the number of cells)
+  std::vector<size_t> cellstart;
+  // source indices, ordered by cell
+  std::vector<size_t> ids;
+  // unit vectors of sources
+  std::vector<std::array<double,3>> unitvecs;
+};
+
+#endif
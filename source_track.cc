@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "source_track.hh"
+#include "common.hh"
+#include "coords.hh"
+
+// maximum error in interpolated position (detector pixels)
+constexpr double TRACK_TOL = 1e-3;
+
+// maximum number of times an attitude interval is halved
+constexpr int TRACK_MAX_DEPTH = 10;
+
+// distance from the source of the furthest detector pixel, to convert
+// errors in roll to position (detector pixels)
+constexpr double TRACK_ROLL_RAD = 544;
+
+namespace
+{
+  struct TrackPoint
+  {
+    double t, x, y, roll;
+  };
+}
+
+SourceTrack::SourceTrack(const SourceVisibility& vis, AttitudeTable& att,
+                         const InstPar& instpar)
+  : maxerr(0)
+{
+  CoordConv coordconv(instpar);
+
+  // attitude can only be interpolated inside table
+  const double tattmin = att.time.front();
+  const double tattmax = att.time.back();
+
+  auto exact = [&](double t)
+    {
+      auto [att_ra, att_dec, att_roll] = att.interpolate(std::clamp(t, tattmin, tattmax));
+      coordconv.updatePointing(att_ra, att_dec, att_roll);
+      auto [x, y] = coordconv.radec2ccd(vis.ra, vis.dec);
+      return TrackPoint{t, x, y, att_roll};
+    };
+
+  // rolls are unwrapped, so they can be interpolated linearly
+  auto add = [&](TrackPoint p)
+    {
+      if(!roll.empty())
+        p.roll = roll.back() + std::remainder(p.roll-roll.back(), 360.);
+      time.push_back(p.t);
+      ccdx.push_back(p.x);
+      ccdy.push_back(p.y);
+      roll.push_back(p.roll);
+    };
+
+  // add points between p0 and p1 until the interpolated value at the
+  // midpoint is close enough to the exact value
+  auto refine = [&](auto& self, const TrackPoint& p0, const TrackPoint& p1,
+                    int depth) -> void
+    {
+      const TrackPoint pm = exact(0.5*(p0.t+p1.t));
+      const double droll0 = std::remainder(p1.roll-p0.roll, 360.);
+      const double drollm = std::remainder(pm.roll-p0.roll, 360.);
+      const double err =
+        std::sqrt(sqr(0.5*(p0.x+p1.x)-pm.x) + sqr(0.5*(p0.y+p1.y)-pm.y)) +
+        std::abs(0.5*droll0-drollm)*DEG2RAD*TRACK_ROLL_RAD;
+
+      if(err > TRACK_TOL && depth < TRACK_MAX_DEPTH)
+        {
+          self(self, p0, pm, depth+1);
+          add(pm);
+          self(self, pm, p1, depth+1);
+        }
+      else
+        maxerr = std::max(maxerr, err);
+    };
+
+  for(size_t i=0; i != vis.start.size(); ++i)
+    {
+      // attitude points covering interval
+      auto it0 = std::upper_bound(att.time.begin(), att.time.end(), vis.start[i]);
+      if(it0 != att.time.begin())
+        --it0;
+      auto it1 = std::lower_bound(att.time.begin(), att.time.end(), vis.stop[i]);
+      if(it1 == att.time.end())
+        --it1;
+
+      // intervals can share attitude points, so continue from the
+      // last point if it is inside this interval's range
+      while(!time.empty() && it0 != it1 && *it0 < time.back())
+        ++it0;
+      if(!time.empty() && *it1 <= time.back())
+        continue;
+
+      TrackPoint plast;
+      if(!time.empty() && *it0 <= time.back())
+        {
+          plast = TrackPoint{time.back(), ccdx.back(), ccdy.back(), roll.back()};
+        }
+      else
+        {
+          plast = exact(*it0);
+          add(plast);
+        }
+      for(auto it=it0+1; it <= it1; ++it)
+        {
+          const TrackPoint p = exact(*it);
+          refine(refine, plast, p, 0);
+          add(p);
+          plast = p;
+        }
+    }
+}
+
+std::tuple<double, double, double> SourceTrack::interpolate(double t) const
+{
+  if(time.empty())
+    return std::make_tuple(0., 0., 0.);
+
+  const size_t i = std::upper_bound(time.begin(), time.end(), t) - time.begin();
+  if(i == 0)
+    return std::make_tuple(ccdx.front(), ccdy.front(),
+                           std::remainder(roll.front(), 360.));
+  if(i == time.size())
+    return std::make_tuple(ccdx.back(), ccdy.back(),
+                           std::remainder(roll.back(), 360.));
+
+  const double f = (t - time[i-1]) / (time[i] - time[i-1]);
+  return std::make_tuple(ccdx[i-1]*(1-f) + ccdx[i]*f,
+                         ccdy[i-1]*(1-f) + ccdy[i]*f,
+                         std::remainder(roll[i-1]*(1-f) + roll[i]*f, 360.));
+}
+
+std::vector<SourceTrack> buildTracks(const std::vector<SourceVisibility>& vis,
+                                     AttitudeTable& att,
+                                     const InstPar& instpar)
+{
+  std::vector<SourceTrack> tracks;
+  size_t npts = 0;
+  double maxerr = 0;
+  for(auto& srcvis : vis)
+    {
+      tracks.emplace_back(srcvis, att, instpar);
+      npts += tracks.back().numPoints();
+      maxerr = std::max(maxerr, tracks.back().maxError());
+    }
+
+  std::printf("  - tabulated source tracks with %ld points (max interpolation error %.2g pix)\n",
+              npts, maxerr);
+  return tracks;
+}
@@ -0,0 +1,42 @@
+#ifndef SOURCE_TRACK_HH
+#define SOURCE_TRACK_HH
+
+#include <tuple>
+#include <vector>
+
+#include "attitude.hh"
+#include "instpar.hh"
+#include "visibility.hh"
+
+// CCD position and roll of a source, tabulated at the attitude table
+// times during the visible intervals of the source, so that they can
+// be interpolated cheaply. Extra points are added where linear
+// interpolation of the position differs from the exact value by more
+// than a tolerance.
+class SourceTrack
+{
+public:
+  SourceTrack(const SourceVisibility& vis, AttitudeTable& att,
+              const InstPar& instpar);
+
+  // get ccdx, ccdy and roll at time t (which should be inside a
+  // visible interval)
+  std::tuple<double, double, double> interpolate(double t) const;
+
+  size_t numPoints() const { return time.size(); }
+
+  // largest difference between the interpolated and exact position
+  // found at the interval midpoints (pixels)
+  double maxError() const { return maxerr; }
+
+private:
+  std::vector<double> time, ccdx, ccdy, roll;
+  double maxerr;
+};
+
+// make the track for each source
+std::vector<SourceTrack> buildTracks(const std::vector<SourceVisibility>& vis,
+                                     AttitudeTable& att,
+                                     const InstPar& instpar);
+
+#endif
@@ -0,0 +1,279 @@
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.hh"
+#include "table_reader.hh"
+
+namespace
+{
+  // convert big-endian value at p to host value
+  template<class U> U load_be(const unsigned char* p)
+  {
+    U v = 0;
+    for(size_t i=0; i != sizeof(U); ++i)
+      v = U(v << 8) | U(p[i]);
+    return v;
+  }
+
+  template<class T> T decode(char code, const unsigned char* p)
+  {
+    switch(code)
+      {
+      case 'B':
+        return T(p[0]);
+      case 'I':
+        return T(int16_t(load_be<uint16_t>(p)));
+      case 'J':
+        return T(int32_t(load_be<uint32_t>(p)));
+      case 'K':
+        return T(int64_t(load_be<uint64_t>(p)));
+      case 'E':
+        {
+          uint32_t u = load_be<uint32_t>(p);
+          float f;
+          std::memcpy(&f, &u, sizeof(f));
+          return T(f);
+        }
+      case 'D':
+        {
+          uint64_t u = load_be<uint64_t>(p);
+          double d;
+          std::memcpy(&d, &u, sizeof(d));
+          return T(d);
+        }
+      default:
+        throw std::runtime_error("unsupported column type");
+      }
+  }
+
+  // decode values in a column, keeping the switch outside the loop
+  template<class T> void decode_col(char code, const unsigned char* p,
+                                    long rowlen, long n, T* out)
+  {
+    auto loop = [&](auto code_c)
+    {
+      for(long i=0; i<n; ++i)
+        out[i] = decode<T>(decltype(code_c)::value, p + i*rowlen);
+    };
+    switch(code)
+      {
+      case 'B': loop(std::integral_constant<char,'B'>()); break;
+      case 'I': loop(std::integral_constant<char,'I'>()); break;
+      case 'J': loop(std::integral_constant<char,'J'>()); break;
+      case 'K': loop(std::integral_constant<char,'K'>()); break;
+      case 'E': loop(std::integral_constant<char,'E'>()); break;
+      case 'D': loop(std::integral_constant<char,'D'>()); break;
+      default:
+        throw std::runtime_error("unsupported column type");
+      }
+  }
+
+  // bytes per element for TFORM type code (0 if unknown)
+  long code_width(char code)
+  {
+    switch(code)
+      {
+      case 'L': case 'A': case 'B': return 1;
+      case 'I': return 2;
+      case 'J': case 'E': return 4;
+      case 'K': case 'D': case 'C': case 'P': return 8;
+      case 'M': case 'Q': return 16;
+      default: return 0;
+      }
+  }
+
+  // can values of this type code be decoded directly?
+  bool decodable(char code)
+  {
+    return code == 'B' || code == 'I' || code == 'J' || code == 'K' ||
+      code == 'E' || code == 'D';
+  }
+
+  // parse TFORM into repeat count and type code
+  bool parse_tform(const char* tform, long& repeat, char& code)
+  {
+    const char* p = tform;
+    while(*p == ' ')
+      ++p;
+    repeat = 1;
+    if(std::isdigit(static_cast<unsigned char>(*p)))
+      {
+        repeat = 0;
+        while(std::isdigit(static_cast<unsigned char>(*p)))
+          repeat = repeat*10 + (*p++ - '0');
+      }
+    code = char(std::toupper(static_cast<unsigned char>(*p)));
+    return code != 0;
+  }
+}
+
+TableReader::TableReader(fitsfile* _ff)
+  : ff(_ff), map(nullptr), mapsize(0), data(nullptr), rowlen(0), nrows(0)
+{
+  tryMap();
+}
+
+TableReader::~TableReader()
+{
+  if(map != nullptr)
+    munmap(const_cast<unsigned char*>(map), mapsize);
+}
+
+void TableReader::tryMap()
+{
+  int status = 0;
+
+  // only plain files on disk can be mapped
+  char filename[FLEN_FILENAME];
+  fits_file_name(ff, filename, &status);
+  if(status != 0)
+    {
+      fits_clear_errmsg();
+      return;
+    }
+  std::error_code ec;
+  if(!std::filesystem::is_regular_file(filename, ec))
+    return;
+
+  // uncompressed FITS files start with SIMPLE
+  {
+    std::ifstream in(filename, std::ios::binary);
+    char magic[6] = {0};
+    in.read(magic, 6);
+    if(!in || std::memcmp(magic, "SIMPLE", 6) != 0)
+      return;
+  }
+
+  LONGLONG headstart, datastart, dataend;
+  fits_get_hduaddrll(ff, &headstart, &datastart, &dataend, &status);
+  long naxis1, naxis2;
+  fits_read_key(ff, TLONG, "NAXIS1", &naxis1, 0, &status);
+  fits_read_key(ff, TLONG, "NAXIS2", &naxis2, 0, &status);
+  if(status != 0)
+    {
+      fits_clear_errmsg();
+      return;
+    }
+
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0)
+    return;
+  struct stat st;
+  if(fstat(fd, &st) == 0 &&
+     LONGLONG(st.st_size) >= datastart + LONGLONG(naxis1)*naxis2)
+    {
+      void* ptr = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+      if(ptr != MAP_FAILED)
+        {
+          map = static_cast<const unsigned char*>(ptr);
+          mapsize = size_t(st.st_size);
+          data = map + datastart;
+          rowlen = naxis1;
+          nrows = naxis2;
+        }
+    }
+  close(fd);
+}
+
+int TableReader::column(const char* name)
+{
+  return get_fits_colnum(ff, name);
+}
+
+bool TableReader::columnLayout(int col, char& code, long& offset)
+{
+  int status = 0;
+  char key[FLEN_KEYWORD];
+  char tform[FLEN_VALUE];
+
+  // scaled columns are left to cfitsio
+  double val;
+  std::snprintf(key, sizeof(key), "TSCAL%d", col);
+  if(fits_read_key(ff, TDOUBLE, key, &val, 0, &status) == 0 && val != 1)
+    return false;
+  status = 0;
+  std::snprintf(key, sizeof(key), "TZERO%d", col);
+  if(fits_read_key(ff, TDOUBLE, key, &val, 0, &status) == 0 && val != 0)
+    return false;
+  status = 0;
+  fits_clear_errmsg();
+
+  // offset is the sum of widths of the previous columns
+  offset = 0;
+  for(int c=1; c <= col; ++c)
+    {
+      std::snprintf(key, sizeof(key), "TFORM%d", c);
+      fits_read_key(ff, TSTRING, key, tform, 0, &status);
+      long repeat;
+      char ccode;
+      if(status != 0 || !parse_tform(tform, repeat, ccode))
+        {
+          fits_clear_errmsg();
+          return false;
+        }
+      if(c == col)
+        {
+          code = ccode;
+          return repeat == 1 && decodable(code);
+        }
+
+      if(ccode == 'X')
+        offset += (repeat+7)/8;
+      else if(code_width(ccode) > 0)
+        offset += repeat*code_width(ccode);
+      else
+        return false;
+    }
+  return false;
+}
+
+bool TableReader::readMapped(int col, int type, long first, long n, void* retn)
+{
+  if(layouts.size() <= size_t(col))
+    layouts.resize(col+1);
+  Layout& lay = layouts[col];
+  if(!lay.known)
+    {
+      lay.direct = columnLayout(col, lay.code, lay.offset);
+      lay.known = true;
+    }
+  if(!lay.direct || first+n > nrows)
+    return false;
+
+  const unsigned char* p = data + first*rowlen + lay.offset;
+  switch(type)
+    {
+    case TSHORT:
+      decode_col(lay.code, p, rowlen, n, static_cast<short*>(retn));
+      return true;
+    case TFLOAT:
+      decode_col(lay.code, p, rowlen, n, static_cast<float*>(retn));
+      return true;
+    case TDOUBLE:
+      decode_col(lay.code, p, rowlen, n, static_cast<double*>(retn));
+      return true;
+    default:
+      return false;
+    }
+}
+
+void TableReader::read(int col, int type, long first, long n, void* retn)
+{
+  if(mapped() && readMapped(col, type, first, n, retn))
+    return;
+
+  int status = 0;
+  fits_read_col(ff, type, col, first+1, 1, n, 0, retn, 0, &status);
+  check_fitsio_status(status);
+}
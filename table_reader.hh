@@ -0,0 +1,62 @@
+#ifndef TABLE_READER_HH
+#define TABLE_READER_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <fitsio.h>
+
+// Read values from columns of the current binary table HDU of an open
+// file. If the file is an uncompressed FITS file on disk, the table is
+// memory mapped and the big-endian values are decoded directly from
+// the mapping, so only the rows read are decoded and the pages are
+// shared between processes reading the same file. Otherwise (e.g. for
+// compressed files or scaled columns) cfitsio is used.
+class TableReader
+{
+public:
+  TableReader(fitsfile* _ff);
+  ~TableReader();
+  TableReader(const TableReader&) = delete;
+  TableReader& operator=(const TableReader&) = delete;
+
+  // get index of column with name given
+  int column(const char* name);
+
+  // read n values from row first (starting from 0) of column col into
+  // retn, which has the cfitsio type given (TSHORT, TFLOAT or TDOUBLE)
+  void read(int col, int type, long first, long n, void* retn);
+
+  // is the table memory mapped?
+  bool mapped() const { return map != nullptr; }
+
+private:
+  // set up mapping if the file is suitable
+  void tryMap();
+  // read values from mapping, returning false if not possible
+  bool readMapped(int col, int type, long first, long n, void* retn);
+  // get type code and offset of column in row, returning false if
+  // the column cannot be decoded directly
+  bool columnLayout(int col, char& code, long& offset);
+
+  // layout of column, looked up when first read
+  struct Layout
+  {
+    bool known = false, direct = false;
+    char code = 0;
+    long offset = 0;
+  };
+
+private:
+  fitsfile* ff;
+
+  // mapping of file and table data within it
+  const unsigned char* map;
+  size_t mapsize;
+  const unsigned char* data;
+  long rowlen, nrows;
+  std::vector<Layout> layouts;
+};
+
+#endif
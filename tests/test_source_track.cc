@@ -0,0 +1,65 @@
+// Check source tracks are refined across attitude points shared by
+// consecutive visible intervals
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "attitude.hh"
+#include "common.hh"
+#include "coords.hh"
+#include "gti.hh"
+#include "instpar.hh"
+#include "proj_mode.hh"
+#include "source_track.hh"
+#include "visibility.hh"
+
+int main()
+{
+  // nominal geometry, 9.6 arcsec pixels with the reference at the centre
+  InstPar instpar(192.5, 192.5, 9.6, 9.6, 0.075, 0.075, 192.5, 192.5);
+
+  // pointing fixed, but rolling quickly, so the source (0.1 deg from
+  // the pointing direction) moves on an arc between attitude points
+  std::vector<double> atime, ara, adec, aroll;
+  for(int i=0; i<=4; ++i)
+    {
+      atime.push_back(i*10.);
+      ara.push_back(10.);
+      adec.push_back(0.);
+      aroll.push_back(i*20.);
+    }
+  AttitudeTable att(atime, ara, adec, aroll);
+
+  // two intervals sharing the attitude point at t=10
+  GTITable gti({2., 12.}, {10., 35.});
+  ProjModeAverageFull projmode;
+  SourceVisibility vis(10., 0.1, projmode, att, gti, instpar, 0);
+
+  SourceTrack track(vis, att, instpar);
+
+  CoordConv coordconv(instpar);
+  int failures = 0;
+  for(double t : {3., 7., 15., 18., 25., 33.})
+    {
+      auto [att_ra, att_dec, att_roll] = att.interpolate(t);
+      coordconv.updatePointing(att_ra, att_dec, att_roll);
+      auto [x, y] = coordconv.radec2ccd(vis.ra, vis.dec);
+      auto [tx, ty, troll] = track.interpolate(t);
+
+      const double err = std::sqrt(sqr(tx-x) + sqr(ty-y));
+      if(err > 0.01)
+        {
+          std::printf("t=%g: track error %g pix\n", t, err);
+          ++failures;
+        }
+    }
+
+  if(failures)
+    {
+      std::printf("test_source_track: FAILED\n");
+      return 1;
+    }
+  std::printf("test_source_track: passed\n");
+  return 0;
+}
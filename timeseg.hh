@@ -0,0 +1,18 @@
+#ifndef TIMESEG_HH
+#define TIMESEG_HH
+
+#include <cstddef>
+
+// a period of time to include in the exposure map for a source
+struct TimeSeg
+{
+  double src_ra, src_dec;
+  size_t idx;
+  double t;
+  float dt;
+  // source position on detector and roll at t (from the source track)
+  float src_ccdx, src_ccdy;
+  double roll;
+};
+
+#endif
@@ -0,0 +1,454 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <utility>
+
+#include "visibility.hh"
+#include "coords.hh"
+#include "source_index.hh"
+
+// precision of interval edges (s)
+constexpr double VIS_TOL = 1e-3;
+
+namespace
+{
+  // number of steps with stride during GTI (steps 0 to nstep are used)
+  int numSteps(double gstart, double gstop, double stride)
+  {
+    return std::max(int(std::ceil((gstop-gstart)/stride)), 1);
+  }
+
+  // time of step i during GTI
+  double stepTime(double gstart, double gstop, double stride,
+                  int i, int nstep)
+  {
+    return (i==nstep) ? gstop : gstart + i*stride;
+  }
+}
+
+SourceVisibility::SourceVisibility(double _ra, double _dec,
+                                   const ProjMode& projmode,
+                                   AttitudeTable& att, const GTITable& gti,
+                                   const InstPar& instpar, double stride,
+                                   const std::vector<std::pair<size_t,size_t>>* nearsteps)
+  : ra(_ra), dec(_dec)
+{
+  if(stride <= 0)
+    {
+      start = gti.start;
+      stop = gti.stop;
+      return;
+    }
+
+  CoordConv coordconv(instpar);
+
+  // attitude can only be interpolated inside table
+  const double tattmin = att.time.front();
+  const double tattmax = att.time.back();
+
+  auto valid = [&](double t)
+    {
+      t = std::clamp(t, tattmin, tattmax);
+      auto [att_ra, att_dec, att_roll] = att.interpolate(t);
+      coordconv.updatePointing(att_ra, att_dec, att_roll);
+      auto [src_ccdx, src_ccdy] = coordconv.radec2ccd(ra, dec);
+      return projmode.sourceValid(Point(src_ccdx, src_ccdy));
+    };
+
+  // find time where validity changes between t1 and t2
+  auto bisect = [&](double t1, double t2, bool v1)
+    {
+      while(t2-t1 > VIS_TOL)
+        {
+          double mid = 0.5*(t1+t2);
+          if(valid(mid) == v1)
+            t1 = mid;
+          else
+            t2 = mid;
+        }
+      return v1 ? t2 : t1;
+    };
+
+  // steps are numbered over all GTIs, to match nearsteps
+  size_t stepoffset = 0;
+  auto nearit = nearsteps ? nearsteps->begin() :
+    std::vector<std::pair<size_t,size_t>>::const_iterator();
+
+  // first possibly valid step in GTI from step i
+  auto nextNear = [&](int i)
+    {
+      const size_t step = stepoffset+i;
+      while(nearit != nearsteps->end() && nearit->second <= step)
+        ++nearit;
+      return nearit != nearsteps->end() ?
+        std::max(nearit->first, step)-stepoffset : size_t(-1);
+    };
+
+  for(size_t gtii=0; gtii != gti.num; ++gtii)
+    {
+      const double gstart = gti.start[gtii];
+      const double gstop = gti.stop[gtii];
+      const int nstep = numSteps(gstart, gstop, stride);
+      auto steptime = [&](int i) { return stepTime(gstart, gstop, stride, i, nstep); };
+
+      double tlast = gstart;
+      bool vlast = (!nearsteps || nextNear(0) == 0) && valid(tlast);
+      double ivstart = gstart;
+      for(int i=1; i<=nstep; ++i)
+        {
+          // skip steps where the source cannot be valid
+          if(nearsteps)
+            {
+              const size_t inext = nextNear(i);
+              if(!vlast && inext > size_t(i))
+                {
+                  if(inext > size_t(nstep))
+                    break;
+                  i = int(inext);
+                  tlast = steptime(i-1);
+                }
+            }
+
+          const double t = steptime(i);
+          const bool v = (!nearsteps || nextNear(i) == size_t(i)) && valid(t);
+          if(v != vlast)
+            {
+              const double tedge = bisect(tlast, t, vlast);
+              if(v)
+                ivstart = std::max(tedge-VIS_TOL, gstart);
+              else
+                {
+                  start.push_back(ivstart);
+                  stop.push_back(std::min(tedge+VIS_TOL, gstop));
+                }
+            }
+          tlast = t;
+          vlast = v;
+        }
+      if(vlast)
+        {
+          start.push_back(ivstart);
+          stop.push_back(gstop);
+        }
+
+      stepoffset += nstep+1;
+    }
+}
+
+SourceVisibility::SourceVisibility(double _ra, double _dec,
+                                   std::vector<double> _start,
+                                   std::vector<double> _stop)
+  : ra(_ra), dec(_dec), start(std::move(_start)), stop(std::move(_stop))
+{
+}
+
+bool SourceVisibility::isVisible(double t) const
+{
+  // find first interval ending at or after t
+  auto it = std::lower_bound(stop.begin(), stop.end(), t);
+  if(it == stop.end())
+    return false;
+  return t >= start[it-stop.begin()];
+}
+
+double SourceVisibility::totalTime() const
+{
+  double tot = 0;
+  for(size_t i=0; i != start.size(); ++i)
+    tot += stop[i]-start[i];
+  return tot;
+}
+
+std::vector<std::pair<size_t,size_t>>
+SourceVisibility::indexRanges(const EventTable& events) const
+{
+  std::vector<std::pair<size_t,size_t>> ranges;
+  size_t first = 0;
+  for(size_t i=0; i != start.size(); ++i)
+    {
+      const size_t lo = events.lowerBound(start[i], first);
+      const size_t hi = events.upperBound(stop[i], lo);
+      if(hi != lo)
+        ranges.emplace_back(lo, hi);
+      first = hi;
+    }
+  return ranges;
+}
+
+namespace
+{
+  // radius on the sky from the pointing direction within which
+  // sources may be valid (deg), or -1 if they can be anywhere
+  double nearRadius(const ProjMode& projmode, const InstPar& instpar)
+  {
+    // the pointing direction is at the reference pixel
+    const float maxdist = projmode.maxValidDistance(Point(instpar.x_ref, instpar.y_ref));
+    if(maxdist < 0)
+      return -1;
+
+    // the detector offset overestimates the angle on the sky, but
+    // pad the radius a little
+    return maxdist *
+      std::max(instpar.x_platescale, instpar.y_platescale) / 3600. + 1./60.;
+  }
+
+  // angle between two directions (deg)
+  double angleBetween(double ra1, double dec1, double ra2, double dec2)
+  {
+    const double c = std::sin(dec1*DEG2RAD)*std::sin(dec2*DEG2RAD) +
+      std::cos(dec1*DEG2RAD)*std::cos(dec2*DEG2RAD)*std::cos((ra2-ra1)*DEG2RAD);
+    return std::acos(std::clamp(c, -1., 1.)) / DEG2RAD;
+  }
+
+  // For each source, get the sorted ranges [first,last) of steps
+  // (numbered over all GTIs) where it is close enough to the pointing
+  // direction that it may be valid, using an index of the sources on
+  // the sky. Returns false if the projection mode allows sources to be
+  // anywhere.
+  bool findNearSteps(const Pars& pars, const ProjMode& projmode,
+                     AttitudeTable& att, const GTITable& gti,
+                     const InstPar& instpar,
+                     std::vector<std::vector<std::pair<size_t,size_t>>>& nearsteps)
+  {
+    const double radius = nearRadius(projmode, instpar);
+    if(radius < 0)
+      return false;
+    std::printf("    - indexing sources within %.3f deg of pointing\n", radius);
+
+    SourceIndex index(pars.sources, radius);
+    nearsteps.assign(pars.sources.size(), std::vector<std::pair<size_t,size_t>>());
+
+    const double tattmin = att.time.front();
+    const double tattmax = att.time.back();
+
+    std::vector<size_t> idxs;
+    size_t step = 0;
+    for(size_t gtii=0; gtii != gti.num; ++gtii)
+      {
+        const double gstart = gti.start[gtii];
+        const double gstop = gti.stop[gtii];
+        const int nstep = numSteps(gstart, gstop, pars.vis_stride);
+        for(int i=0; i<=nstep; ++i, ++step)
+          {
+            const double t = std::clamp(stepTime(gstart, gstop, pars.vis_stride, i, nstep),
+                                        tattmin, tattmax);
+            auto [att_ra, att_dec, att_roll] = att.interpolate(t);
+
+            idxs.clear();
+            index.query(att_ra, att_dec, radius, idxs);
+            for(size_t idx : idxs)
+              {
+                // extend the range if the source was near at the last step
+                auto& ranges = nearsteps[idx];
+                if(!ranges.empty() && ranges.back().second == step)
+                  ranges.back().second = step+1;
+                else
+                  ranges.emplace_back(step, step+1);
+              }
+          }
+      }
+
+    return true;
+  }
+}
+
+namespace
+{
+  // Without a stride, find intervals for each source during the GTIs
+  // where it may be valid, from the attitude points where it is near
+  // the pointing direction, using an index of the sources on the
+  // sky. The radius is padded by half the largest motion between
+  // attitude points, so a source close to the pointing between two
+  // points is near at one of them. Returns false if the projection
+  // mode allows sources to be anywhere.
+  bool findNearIntervals(const Pars& pars, const ProjMode& projmode,
+                         AttitudeTable& att, const GTITable& gti,
+                         const InstPar& instpar,
+                         std::vector<std::vector<double>>& starts,
+                         std::vector<std::vector<double>>& stops)
+  {
+    double radius = nearRadius(projmode, instpar);
+    if(radius < 0 || att.num == 0)
+      return false;
+
+    // attitude points covering each GTI
+    std::vector<std::pair<size_t,size_t>> gtinodes;
+    double maxmove = 0;
+    for(size_t gtii=0; gtii != gti.num; ++gtii)
+      {
+        size_t n0 = std::upper_bound(att.time.begin(), att.time.end(), gti.start[gtii]) -
+          att.time.begin();
+        if(n0 > 0)
+          --n0;
+        size_t n1 = std::lower_bound(att.time.begin(), att.time.end(), gti.stop[gtii]) -
+          att.time.begin();
+        n1 = std::min(n1, att.num-1);
+        gtinodes.emplace_back(n0, n1);
+        for(size_t n=n0; n<n1; ++n)
+          maxmove = std::max(maxmove, angleBetween(att.ra[n], att.dec[n],
+                                                   att.ra[n+1], att.dec[n+1]));
+      }
+    radius += 0.5*maxmove;
+    std::printf("    - indexing sources within %.3f deg of pointing\n", radius);
+
+    // ranges [first,last) of attitude points where each source is near
+    SourceIndex index(pars.sources, radius);
+    std::vector<std::vector<std::pair<size_t,size_t>>> nearnodes(pars.sources.size());
+    std::vector<size_t> idxs;
+    size_t nextnode = 0;
+    for(auto [n0, n1] : gtinodes)
+      for(size_t n=std::max(n0, nextnode); n<=n1; ++n)
+        {
+          idxs.clear();
+          index.query(att.ra[n], att.dec[n], radius, idxs);
+          for(size_t idx : idxs)
+            {
+              auto& ranges = nearnodes[idx];
+              if(!ranges.empty() && ranges.back().second == n)
+                ranges.back().second = n+1;
+              else
+                ranges.emplace_back(n, n+1);
+            }
+          nextnode = n+1;
+        }
+
+    // a source may be valid between the attitude points either side
+    // of each range (the attitude is constant outside the table),
+    // clipped to the GTIs
+    const double inf = std::numeric_limits<double>::infinity();
+    starts.assign(pars.sources.size(), std::vector<double>());
+    stops.assign(pars.sources.size(), std::vector<double>());
+    for(size_t s=0; s != pars.sources.size(); ++s)
+      {
+        size_t gtii = 0;
+        for(auto [first, last] : nearnodes[s])
+          {
+            const double ts = first == 0 ? -inf : att.time[first-1];
+            const double te = last >= att.num ? inf : att.time[last];
+            while(gtii != gti.num && gti.stop[gtii] < ts)
+              ++gtii;
+            for(size_t g=gtii; g != gti.num && gti.start[g] <= te; ++g)
+              {
+                const double a = std::max(ts, gti.start[g]);
+                const double b = std::min(te, gti.stop[g]);
+                if(b <= a)
+                  continue;
+                // join intervals which meet
+                if(!stops[s].empty() && a <= stops[s].back())
+                  stops[s].back() = std::max(stops[s].back(), b);
+                else
+                  {
+                    starts[s].push_back(a);
+                    stops[s].push_back(b);
+                  }
+              }
+          }
+        nearnodes[s] = std::vector<std::pair<size_t,size_t>>();
+      }
+
+    return true;
+  }
+}
+
+std::vector<SourceVisibility> buildVisibility(const Pars& pars,
+                                              const ProjMode& projmode,
+                                              AttitudeTable& att,
+                                              const GTITable& gti,
+                                              const InstPar& instpar)
+{
+  std::printf("  - finding source visibility (stride %g s)\n", pars.vis_stride);
+
+  double gtitot = 0;
+  for(size_t i=0; i != gti.num; ++i)
+    gtitot += gti.stop[i]-gti.start[i];
+
+  std::vector<std::vector<std::pair<size_t,size_t>>> nearsteps;
+  const bool near = pars.vis_stride > 0 &&
+    findNearSteps(pars, projmode, att, gti, instpar, nearsteps);
+
+  // without a stride, sources are limited to the times they are near
+  // the pointing direction
+  std::vector<std::vector<double>> nearstarts, nearstops;
+  const bool nearivs = pars.vis_stride <= 0 &&
+    findNearIntervals(pars, projmode, att, gti, instpar, nearstarts, nearstops);
+
+  const bool showall = pars.sources.size() <= Pars::max_show_sources;
+
+  std::vector<SourceVisibility> vis;
+  size_t numvisible = 0;
+  for(size_t i=0; i != pars.sources.size(); ++i)
+    {
+      auto& src = pars.sources[i];
+      if(nearivs)
+        vis.emplace_back(src[0], src[1], std::move(nearstarts[i]), std::move(nearstops[i]));
+      else
+        vis.emplace_back(src[0], src[1], projmode, att, gti, instpar,
+                         pars.vis_stride, near ? &nearsteps[i] : nullptr);
+      if(near)
+        nearsteps[i] = std::vector<std::pair<size_t,size_t>>();
+
+      if(!vis.back().start.empty())
+        ++numvisible;
+      if(showall)
+        std::printf("    - source (%g,%g): %ld intervals, %.1f of %.1f s\n",
+                    src[0], src[1], vis.back().start.size(),
+                    vis.back().totalTime(), gtitot);
+    }
+  if(!showall)
+    std::printf("    - %ld of %ld sources visible\n", numvisible, vis.size());
+
+  return vis;
+}
+
+std::vector<std::vector<size_t>>
+rangeSources(const std::vector<SourceVisibility>& vis,
+             const EventTable& events,
+             const std::vector<std::pair<size_t,size_t>>& ranges)
+{
+  // time of last entry in each range
+  std::vector<double> rangeend;
+  for(auto& r : ranges)
+    rangeend.push_back(events.getTime(r.second-1));
+
+  std::vector<std::vector<size_t>> srcs(ranges.size());
+  for(size_t s=0; s != vis.size(); ++s)
+    {
+      const SourceVisibility& sv = vis[s];
+      size_t ri = 0;
+      for(size_t i=0; i != sv.start.size(); ++i)
+        {
+          // first range ending at or after the interval start
+          ri = std::lower_bound(rangeend.begin()+ri, rangeend.end(),
+                                sv.start[i]) - rangeend.begin();
+          for(size_t j=ri; j < ranges.size() && events.getTime(ranges[j].first) <= sv.stop[i]; ++j)
+            if(srcs[j].empty() || srcs[j].back() != s)
+              srcs[j].push_back(s);
+        }
+    }
+  return srcs;
+}
+
+std::vector<std::pair<size_t,size_t>>
+anyVisibleRanges(const std::vector<SourceVisibility>& vis,
+                 const EventTable& events)
+{
+  std::vector<std::pair<size_t,size_t>> ranges;
+  for(auto& srcvis : vis)
+    {
+      auto r = srcvis.indexRanges(events);
+      ranges.insert(ranges.end(), r.begin(), r.end());
+    }
+  std::sort(ranges.begin(), ranges.end());
+
+  // merge overlapping ranges
+  std::vector<std::pair<size_t,size_t>> merged;
+  for(auto& r : ranges)
+    {
+      if(!merged.empty() && r.first <= merged.back().second)
+        merged.back().second = std::max(merged.back().second, r.second);
+      else
+        merged.push_back(r);
+    }
+  return merged;
+}
@@ -0,0 +1,69 @@
+#ifndef VISIBILITY_HH
+#define VISIBILITY_HH
+
+#include <utility>
+#include <vector>
+
+#include "pars.hh"
+
+// Time intervals where a source is valid for the projection mode.
+// These are found by evaluating the source position with a time
+// stride during the GTIs, then bisecting at changes in
+// validity. Visible periods shorter than the stride may be missed.
+class SourceVisibility
+{
+public:
+  // nearsteps, if given, lists the sorted ranges [first,last) of
+  // steps (numbered over all GTIs) where the source may be valid, so
+  // others do not need checking
+  SourceVisibility(double _ra, double _dec, const ProjMode& projmode,
+                   AttitudeTable& att, const GTITable& gti,
+                   const InstPar& instpar, double stride,
+                   const std::vector<std::pair<size_t,size_t>>* nearsteps = nullptr);
+
+  // make from intervals found already
+  SourceVisibility(double _ra, double _dec,
+                   std::vector<double> _start, std::vector<double> _stop);
+
+  // is the time inside one of the intervals?
+  bool isVisible(double t) const;
+
+  // total time inside intervals
+  double totalTime() const;
+
+  // ranges of indices [first,last) of events inside the intervals
+  std::vector<std::pair<size_t,size_t>> indexRanges(const EventTable& events) const;
+
+public:
+  double ra, dec;
+  // intervals (start<=t<=stop), in time order and within the GTIs
+  std::vector<double> start, stop;
+};
+
+// make visibility for each source in the parameters
+// stride<=0 uses the GTIs without searching, limited to the times the
+// source is near the pointing direction if the projection mode limits
+// where sources are valid
+// otherwise, if the projection mode limits where sources are valid,
+// only sources near the pointing direction at each step are searched
+std::vector<SourceVisibility> buildVisibility(const Pars& pars,
+                                              const ProjMode& projmode,
+                                              AttitudeTable& att,
+                                              const GTITable& gti,
+                                              const InstPar& instpar);
+
+// ranges of indices [first,last) of events where any of the sources
+// are visible
+std::vector<std::pair<size_t,size_t>>
+anyVisibleRanges(const std::vector<SourceVisibility>& vis,
+                 const EventTable& events);
+
+// indices of sources which may be visible during each range of
+// indices [first,last) of events, where the ranges are in order and
+// do not overlap
+std::vector<std::vector<size_t>>
+rangeSources(const std::vector<SourceVisibility>& vis,
+             const EventTable& events,
+             const std::vector<std::pair<size_t,size_t>>& ranges);
+
+#endif